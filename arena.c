@@ -0,0 +1,102 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGNMENT 16
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  size_t size;   // usable bytes after the header
+  size_t used;
+};
+
+// header size rounded up so the data that follows it is aligned
+#define HEADER_SIZE                                                            \
+  ((sizeof(ArenaBlock) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+
+static char *block_data(ArenaBlock *block) {
+  return (char *)block + HEADER_SIZE;
+}
+
+static ArenaBlock *new_block(size_t size) {
+  ArenaBlock *block = malloc(HEADER_SIZE + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+void arena_init(Arena *arena, size_t block_size) {
+  arena->head = NULL;
+  arena->block_size = block_size > 0 ? block_size : 4096;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+  ArenaBlock *block = arena->head;
+
+  if (block == NULL || block->size - block->used < size) {
+    size_t block_size = arena->block_size;
+    while (block_size < size) {
+      block_size *= 2;
+    }
+    block = new_block(block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->head;
+    arena->head = block;
+  }
+
+  void *result = block_data(block) + block->used;
+  block->used += size;
+  return result;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t len) {
+  char *copy = arena_alloc(arena, len + 1);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void arena_reset(Arena *arena) {
+  ArenaBlock *block = arena->head;
+  if (block == NULL) {
+    return;
+  }
+  if (block->next == NULL) {
+    // the common case: one block, just rewind it
+    block->used = 0;
+    return;
+  }
+
+  // the line outgrew the first block, keep a single block of the total size
+  size_t total = 0;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    total += block->size;
+    free(block);
+    block = next;
+  }
+  arena->head = NULL;
+  if (total > arena->block_size) {
+    arena->block_size = total;
+  }
+}
+
+void arena_free(Arena *arena) {
+  ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head = NULL;
+}
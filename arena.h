@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+// bump allocator for memory that lives exactly as long as one input line.
+// Nothing is freed on its own, arena_reset() drops everything at once.
+typedef struct {
+  ArenaBlock *head;     // block currently being filled, newest first
+  size_t block_size;    // size of the next block to allocate
+} Arena;
+
+void arena_init(Arena *arena, size_t block_size);
+
+// returns size bytes aligned for any type, or NULL if malloc fails
+void *arena_alloc(Arena *arena, size_t size);
+
+// copies len bytes of s and adds a '\0'
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+
+// forgets every allocation. If the last line needed more than one block,
+// they are replaced by one block big enough for all of them, so the next
+// line of the same size costs no malloc at all.
+void arena_reset(Arena *arena);
+
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,151 @@
+#!/bin/bash
+
+# runs generated scripts under mysh, dash and bash and prints one line per
+# run: shell, style, lines, seconds, lines/sec, forks and peak rss.
+# Every style is written twice, once in mysh syntax and once in sh syntax,
+# with the same commands. Everything runs offline.
+#
+#   ./bench-mysh.sh
+#   SIZES="10000 1000000" STYLES="builtin andor" ./bench-mysh.sh
+#
+# SIZES    script lengths in lines (default 10000)
+# STYLES   any of builtin external pipeline andor (default all)
+# SHELLS   which shells to run, missing ones are skipped (default mysh dash bash)
+# RUNS     runs per case, the fastest one is reported (default 3)
+# MYSH     the mysh to run (default ./mysh_bench, see make bench_mysh)
+
+SIZES="${SIZES:-10000}"
+STYLES="${STYLES:-builtin external pipeline andor}"
+SHELLS="${SHELLS:-mysh dash bash}"
+RUNS="${RUNS:-3}"
+MYSH="${MYSH:-./mysh_bench}"
+BENCH_RUN="${BENCH_RUN:-./bench_run}"
+
+BENCH_DIR="/tmp/mysh_bench_$$"
+
+setup() {
+  for tool in "$MYSH" "$BENCH_RUN"; do
+    if [ ! -x "$tool" ]; then
+      echo "Error: $tool not found, run make bench_mysh" >&2
+      exit 1
+    fi
+  done
+  MYSH="$(cd "$(dirname "$MYSH")" && pwd)/$(basename "$MYSH")"
+  BENCH_RUN="$(cd "$(dirname "$BENCH_RUN")" && pwd)/$(basename "$BENCH_RUN")"
+
+  mkdir -p "$BENCH_DIR"
+  cd "$BENCH_DIR" || exit 1
+}
+
+cleanup() {
+  cd /
+  rm -rf "$BENCH_DIR"
+}
+
+# each style is a block of mysh lines and the same block as one or more
+# sh lines. The blocks repeat until the script has the asked for lines.
+# and/or only exist in mysh as line prefixes, so a chain of them becomes
+# one sh line joined with && and ||, which runs the same way left to right.
+
+builtin_block() {
+  printf 'echo hello world\ntrue\ntest -d /tmp\npwd\n'
+}
+
+external_block() {
+  printf '/bin/true\nls / > /dev/null\nuname -s\n/bin/echo hello\n'
+}
+
+pipeline_block() {
+  printf 'echo hello | cat | wc -c\nls / | sort | tail -n 1\n'
+  printf 'echo a b c | tr a-z A-Z\nuname -a | cat | cat | cat\n'
+}
+
+andor_block() {
+  if [ "$1" = mysh ]; then
+    printf 'true\nand echo yes\nor echo no\nfalse\nor true\nand echo again\n'
+  else
+    printf 'true && echo yes || echo no\nfalse || true && echo again\n'
+  fi
+}
+
+# generate <style> <mysh|sh> <lines> <file>, counted in mysh lines
+generate() {
+  local style="$1" syntax="$2" lines="$3" file="$4"
+  local block_lines
+  block_lines=$("${style}_block" mysh | wc -l)
+  local repeats=$(((lines + block_lines - 1) / block_lines))
+  local block
+  block=$("${style}_block" "$syntax")
+  : >"$file"
+  # doubling keeps this fast for a million lines
+  local chunk="$block" done=1
+  while [ $((done * 2)) -le "$repeats" ]; do
+    chunk="$chunk"$'\n'"$chunk"
+    done=$((done * 2))
+  done
+  printf '%s\n' "$chunk" >>"$file"
+  while [ "$done" -lt "$repeats" ]; do
+    printf '%s\n' "$block" >>"$file"
+    done=$((done + 1))
+  done
+  echo $((repeats * block_lines))
+}
+
+shell_command() {
+  case "$1" in
+  mysh) echo "$MYSH" ;;
+  *) command -v "$1" ;;
+  esac
+}
+
+run_case() {
+  local shell="$1" style="$2" lines="$3" script="$4"
+  local path
+  path=$(shell_command "$shell")
+  local best_ns="" best_forks="" best_rss="" result
+  for ((run = 0; run < RUNS; run++)); do
+    result=$("$BENCH_RUN" "$path" "$script")
+    read -r ns forks rss status <<<"$result"
+    if [ "$status" != 0 ] && [ "$style" != andor ]; then
+      echo "warning: $shell $style exited with $status" >&2
+    fi
+    if [ -z "$best_ns" ] || [ "$ns" -lt "$best_ns" ]; then
+      best_ns="$ns"
+      best_forks="$forks"
+      best_rss="$rss"
+    fi
+  done
+  awk -v shell="$shell" -v style="$style" -v lines="$lines" \
+    -v ns="$best_ns" -v forks="$best_forks" -v rss="$best_rss" 'BEGIN {
+      secs = ns / 1e9
+      printf "%-6s %-9s %8d %9.3f %12.0f %8d %9d\n",
+             shell, style, lines, secs, lines / secs, forks, rss
+    }'
+}
+
+main() {
+  setup
+  trap cleanup EXIT
+
+  printf "%-6s %-9s %8s %9s %12s %8s %9s\n" \
+    shell style lines seconds lines/sec forks rss_kb
+  for size in $SIZES; do
+    for style in $STYLES; do
+      local lines
+      lines=$(generate "$style" mysh "$size" "$style.mysh")
+      generate "$style" sh "$size" "$style.sh" >/dev/null
+      for shell in $SHELLS; do
+        if [ -z "$(shell_command "$shell")" ]; then
+          continue
+        fi
+        if [ "$shell" = mysh ]; then
+          run_case "$shell" "$style" "$lines" "$style.mysh"
+        else
+          run_case "$shell" "$style" "$lines" "$style.sh"
+        fi
+      done
+    done
+  done
+}
+
+main
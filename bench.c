@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include "arena.h"
+#include "dynamic_array.h"
+#include "executor.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// microbenchmarks for the parser, the path lookup, Array and execute().
+// Every benchmark prints one JSON object per line:
+//   {"bench":"parse_short","samples":200,"batch":1000,"mean_ns":...,
+//    "min_ns":...,"p50_ns":...,"p90_ns":...,"p99_ns":...,"max_ns":...}
+// ns are per operation. Fast operations are timed in batches so the clock
+// itself doesn't show up in the numbers, the percentiles are over batches.
+// usage: ./bench [name-substring]
+
+#define SAMPLES 200
+
+static const char *SHORT_LINE = "ls -l";
+static const char *LONG_LINE =
+    "gcc -g -Wall -Wvla -std=c99 -pthread -O2 -c parser.c -o parser.o "
+    "-I include -I ../common -D NDEBUG -D VERSION=4 -fno-omit-frame-pointer "
+    "-fstack-protector-strong -Wextra -Wshadow -Wformat=2 > build.log";
+static const char *OPERATOR_LINE =
+    "and a < in.txt | b | c | d | e | f | g | h > out.txt";
+
+static const char *filter;
+static long long samples[SAMPLES];
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *name, int count, int batch) {
+  qsort(samples, count, sizeof(long long), compare_ll);
+  long long total = 0;
+  for (int i = 0; i < count; i++) {
+    total += samples[i];
+  }
+  printf("{\"bench\":\"%s\",\"samples\":%d,\"batch\":%d,\"mean_ns\":%.1f,"
+         "\"min_ns\":%.1f,\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,"
+         "\"max_ns\":%.1f}\n",
+         name, count, batch, total / (double)count / batch,
+         samples[0] / (double)batch, samples[count / 2] / (double)batch,
+         samples[(count * 90) / 100] / (double)batch,
+         samples[(count * 99) / 100] / (double)batch,
+         samples[count - 1] / (double)batch);
+  fflush(stdout);
+}
+
+static int wanted(const char *name) {
+  return filter == NULL || strstr(name, filter) != NULL;
+}
+
+// one benchmark: op runs batch times per sample after a warm up sample
+typedef void (*BenchOp)(void *arg);
+
+static void bench(const char *name, BenchOp op, void *arg, int count, int batch) {
+  if (!wanted(name)) {
+    return;
+  }
+  for (int i = 0; i < batch; i++) {
+    op(arg);
+  }
+  for (int s = 0; s < count; s++) {
+    long long start = now_ns();
+    for (int i = 0; i < batch; i++) {
+      op(arg);
+    }
+    samples[s] = now_ns() - start;
+  }
+  report(name, count, batch);
+}
+
+// the compiler must not drop work whose result nobody reads
+static volatile long sink;
+
+static Arena arena;
+
+static void op_tokenize(void *arg) {
+  const char *line = arg;
+  Token *tokens;
+  sink += tokenize(line, strlen(line), &arena, &tokens);
+  arena_reset(&arena);
+}
+
+// parse() the way a script line is parsed, out of the arena
+static void op_parse(void *arg) {
+  ParsedCmd *parsed = parse_arena(arg, &arena);
+  sink += parsed != NULL ? parsed->num_commands : -1;
+  arena_reset(&arena);
+}
+
+// parse() with its one malloc and free
+static void op_parse_malloc(void *arg) {
+  ParsedCmd *parsed = parse(arg);
+  sink += parsed != NULL ? parsed->num_commands : -1;
+  free_parsed_cmd(parsed);
+}
+
+static void op_find(void *arg) { sink += findFunction(arg) != NULL; }
+
+static void op_find_builtin(void *arg) { sink += find_builtin(arg) != NULL; }
+
+// grows an Array from 1 to size elements
+static void op_array(void *arg) {
+  size_t size = *(size_t *)arg;
+  static char element[] = "x";
+  Array a;
+  initArray(&a, 1);
+  for (size_t i = 0; i < size; i++) {
+    insertArray(&a, element);
+  }
+  sink += a.used;
+  // the elements aren't ours to free, freeArray() would
+  free(a.array);
+}
+
+static void op_execute(void *arg) {
+  int should_exit = 0;
+  sink += execute(arg, EXIT_SUCCESS, 1, &should_exit);
+}
+
+static void bench_execute(const char *name, const char *line, int count) {
+  if (!wanted(name)) {
+    return;
+  }
+  ParsedCmd *parsed = parse(line);
+  if (parsed == NULL) {
+    fprintf(stderr, "bench: can't parse %s\n", line);
+    exit(EXIT_FAILURE);
+  }
+  bench(name, op_execute, parsed, count, 1);
+  free_parsed_cmd(parsed);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [name-substring]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  filter = argc > 1 ? argv[1] : NULL;
+  arena_init(&arena, 4096);
+
+  bench("tokenize_short", op_tokenize, (void *)SHORT_LINE, SAMPLES, 1000);
+  bench("tokenize_long", op_tokenize, (void *)LONG_LINE, SAMPLES, 1000);
+  bench("tokenize_operators", op_tokenize, (void *)OPERATOR_LINE, SAMPLES, 1000);
+  bench("parse_short", op_parse, (void *)SHORT_LINE, SAMPLES, 1000);
+  bench("parse_long", op_parse, (void *)LONG_LINE, SAMPLES, 1000);
+  bench("parse_operators", op_parse, (void *)OPERATOR_LINE, SAMPLES, 1000);
+  bench("parse_malloc_long", op_parse_malloc, (void *)LONG_LINE, SAMPLES, 1000);
+
+  // misses are remembered too, so both run out of the path cache
+  bench("find_function_hit", op_find, "ls", SAMPLES, 1000);
+  bench("find_function_miss", op_find, "no-such-command", SAMPLES, 1000);
+  bench("find_function_slash", op_find, "/bin/ls", SAMPLES, 100);
+  bench("find_builtin_hit", op_find_builtin, "echo", SAMPLES, 1000);
+  bench("find_builtin_miss", op_find_builtin, "ls", SAMPLES, 1000);
+
+  size_t small = 16, large = 65536;
+  bench("array_grow_16", op_array, &small, SAMPLES, 1000);
+  bench("array_grow_65536", op_array, &large, SAMPLES, 1);
+
+  bench_execute("execute_builtin", "true", SAMPLES);
+  bench_execute("execute_single", "/bin/true", SAMPLES);
+  bench_execute("execute_pipe_4", "/bin/true | /bin/cat | /bin/cat | /bin/cat",
+                SAMPLES / 2);
+  bench_execute("execute_builtin_pipe_4", "echo hi | cat | cat | cat > /dev/null",
+                SAMPLES);
+
+  arena_free(&arena);
+  return EXIT_SUCCESS;
+}
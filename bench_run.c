@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// runs a command with its output thrown away and prints
+// "<real ns> <forks> <max rss kb> <exit status>", for bench-mysh.sh.
+// It is small on purpose: the max rss of a child that execs counts the
+// memory of whoever started it.
+// Forks are read from the processes line of /proc/stat, so they count the
+// whole machine while the command runs.
+// usage: ./bench_run command [args...]
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// processes created since boot, or -1
+static long long forks_so_far(void) {
+  FILE *stat = fopen("/proc/stat", "r");
+  if (stat == NULL) {
+    return -1;
+  }
+  char line[256];
+  long long forks = -1;
+  while (fgets(line, sizeof(line), stat) != NULL) {
+    if (strncmp(line, "processes ", 10) == 0) {
+      forks = atoll(line + 10);
+      break;
+    }
+  }
+  fclose(stat);
+  return forks;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s command [args...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  long long forks = forks_so_far();
+  long long start = now_ns();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork failed");
+    return EXIT_FAILURE;
+  }
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+      perror("/dev/null");
+      _exit(127);
+    }
+    close(null_fd);
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("wait4 failed");
+    return EXIT_FAILURE;
+  }
+  long long elapsed = now_ns() - start;
+  if (forks >= 0) {
+    // not counting our own
+    forks = forks_so_far() - forks - 1;
+  }
+
+  printf("%lld %lld %ld %d\n", elapsed, forks, usage.ru_maxrss,
+         WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+  return EXIT_SUCCESS;
+}
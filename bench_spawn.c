@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include "spawner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// compares how long it takes to start and reap /bin/true with each spawn
+// backend while the shell holds a large, touched heap.
+// usage: ./bench_spawn [iterations] [heap_mb]
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static void run(const char *name, SpawnBackend backend, int iterations,
+                long long *samples, int heap_mb) {
+  char *argv[] = {"true", NULL};
+  spawner_set_backend(backend);
+
+  for (int i = 0; i < iterations; i++) {
+    long long start = now_ns();
+    pid_t pid = spawn_command("/bin/true", argv, STDIN_FILENO, STDOUT_FILENO);
+    if (pid < 0) {
+      perror("spawn_command");
+      exit(EXIT_FAILURE);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    samples[i] = now_ns() - start;
+  }
+
+  qsort(samples, iterations, sizeof(long long), compare_ll);
+  long long total = 0;
+  for (int i = 0; i < iterations; i++) {
+    total += samples[i];
+  }
+  printf("backend=%s heap_mb=%d iterations=%d mean_us=%.1f p50_us=%.1f "
+         "p99_us=%.1f\n",
+         name, heap_mb, iterations, total / (double)iterations / 1000.0,
+         samples[iterations / 2] / 1000.0,
+         samples[(iterations * 99) / 100] / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  int heap_mb = argc > 2 ? atoi(argv[2]) : 256;
+  if (iterations <= 0 || heap_mb < 0) {
+    fprintf(stderr, "usage: %s [iterations] [heap_mb]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // the zygote is forked now, before the heap is there, like mysh does
+  spawner_set_backend(SPAWN_ZYGOTE);
+
+  // touch every page so fork() has real page tables to copy
+  size_t heap_size = (size_t)heap_mb * 1024 * 1024;
+  char *heap = malloc(heap_size > 0 ? heap_size : 1);
+  if (heap == NULL) {
+    perror("malloc failed");
+    return EXIT_FAILURE;
+  }
+  memset(heap, 1, heap_size);
+
+  long long *samples = malloc(iterations * sizeof(long long));
+  if (samples == NULL) {
+    perror("malloc failed");
+    free(heap);
+    return EXIT_FAILURE;
+  }
+
+  run("fork", SPAWN_FORK, iterations, samples, heap_mb);
+  run("posix_spawn", SPAWN_POSIX, iterations, samples, heap_mb);
+  run("zygote", SPAWN_ZYGOTE, iterations, samples, heap_mb);
+
+  free(samples);
+  free(heap);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1016 @@
+#define _GNU_SOURCE
+#include "builtins.h"
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// collects output so a builtin writes it with as few write() calls as
+// possible, usually one
+typedef struct {
+  Stream *out;
+  size_t len;
+  int failed;
+  char buf[4096];
+} Writer;
+
+static void writer_init(Writer *w, Stream *out) {
+  // anything the shell printf()ed before has to come out first
+  fflush(stdout);
+  w->out = out;
+  w->len = 0;
+  w->failed = 0;
+}
+
+static void writer_flush(Writer *w) {
+  if (w->len > 0 && !w->failed &&
+      stream_write(w->out, w->buf, w->len) != (ssize_t)w->len) {
+    w->failed = 1;
+  }
+  w->len = 0;
+}
+
+static void put(Writer *w, const char *s, size_t len) {
+  while (len > 0) {
+    if (w->len == sizeof(w->buf)) {
+      writer_flush(w);
+    }
+    size_t n = sizeof(w->buf) - w->len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+    s += n;
+    len -= n;
+  }
+}
+
+static void put_char(Writer *w, char c) { put(w, &c, 1); }
+
+static void put_formatted(Writer *w, const char *format, ...) {
+  char small[256];
+  va_list args, again;
+  va_start(args, format);
+  va_copy(again, args);
+  int len = vsnprintf(small, sizeof(small), format, args);
+  if (len >= (int)sizeof(small)) {
+    char *big = malloc(len + 1);
+    if (big != NULL) {
+      vsnprintf(big, len + 1, format, again);
+      put(w, big, len);
+      free(big);
+    }
+  } else if (len > 0) {
+    put(w, small, len);
+  }
+  va_end(again);
+  va_end(args);
+}
+
+static int is_octal(char c) { return c >= '0' && c <= '7'; }
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/*
+Expands the escape after a '\' at s and returns how many chars it used.
+In a printf format an octal escape is \NNN, for echo -e and %b it is \0NNN.
+\c sets stop: nothing more is printed.
+*/
+static size_t expand_escape(char *out, const char *s, int in_format,
+                            int *stop) {
+  switch (*s) {
+  case 'a': *out = '\a'; return 1;
+  case 'b': *out = '\b'; return 1;
+  case 'e': *out = '\033'; return 1;
+  case 'f': *out = '\f'; return 1;
+  case 'n': *out = '\n'; return 1;
+  case 'r': *out = '\r'; return 1;
+  case 't': *out = '\t'; return 1;
+  case 'v': *out = '\v'; return 1;
+  case '\\': *out = '\\'; return 1;
+  case 'c':
+    *stop = 1;
+    return 1;
+  case 'x': {
+    int value = 0, used = 1;
+    while (used < 3 && hex_value(s[used]) >= 0) {
+      value = value * 16 + hex_value(s[used++]);
+    }
+    if (used == 1) {
+      break;
+    }
+    *out = (char)value;
+    return used;
+  }
+  default:
+    if (is_octal(*s) && (in_format || *s == '0')) {
+      int value = 0, used = in_format ? 0 : 1;
+      int limit = used + 3;
+      while (used < limit && is_octal(s[used])) {
+        value = value * 8 + (s[used++] - '0');
+      }
+      *out = (char)value;
+      return used;
+    }
+    if (in_format && *s == '"') {
+      *out = '"';
+      return 1;
+    }
+    break;
+  }
+  // not an escape, keep the backslash
+  *out = '\\';
+  return 0;
+}
+
+// writes str with its escapes expanded, returns 1 if a \c stopped it
+static int put_escaped(Writer *w, const char *str, int in_format) {
+  int stop = 0;
+  for (const char *p = str; *p && !stop; p++) {
+    if (*p != '\\' || p[1] == '\0') {
+      put_char(w, *p);
+      continue;
+    }
+    char c;
+    size_t used = expand_escape(&c, p + 1, in_format, &stop);
+    if (!stop) {
+      put_char(w, c);
+    }
+    p += used;
+  }
+  return stop;
+}
+
+/*
+echo [-neE] [string...]
+Options work like /bin/echo: a leading arg made only of n, e and E letters
+is an option. -n drops the newline, -e expands escapes, -E doesn't.
+*/
+int builtin_echo(int num_args, char **args, Stream *out) {
+  int newline = 1, escapes = 0;
+  int i = 1;
+  for (; i < num_args; i++) {
+    const char *arg = args[i];
+    if (arg[0] != '-' || arg[1] == '\0' ||
+        strspn(arg + 1, "neE") != strlen(arg + 1)) {
+      break;
+    }
+    for (const char *c = arg + 1; *c; c++) {
+      if (*c == 'n') {
+        newline = 0;
+      } else {
+        escapes = *c == 'e';
+      }
+    }
+  }
+
+  Writer w;
+  writer_init(&w, out);
+  int stop = 0;
+  for (int first = i; i < num_args && !stop; i++) {
+    if (i > first) {
+      put_char(&w, ' ');
+    }
+    if (escapes) {
+      stop = put_escaped(&w, args[i], 0);
+    } else {
+      put(&w, args[i], strlen(args[i]));
+    }
+  }
+  if (newline && !stop) {
+    put_char(&w, '\n');
+  }
+  writer_flush(&w);
+  return w.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+sleep number[smhd]...
+Sleeps for the sum of its args, which may have fractions like 0.5.
+*/
+int builtin_sleep(int num_args, char **args) {
+  if (num_args < 2) {
+    fprintf(stderr, "sleep: missing operand\n");
+    return EXIT_FAILURE;
+  }
+  double total = 0;
+  for (int i = 1; i < num_args; i++) {
+    char *end;
+    double value = strtod(args[i], &end);
+    double unit = 0;
+    if (end != args[i] && value >= 0) {
+      if (*end == '\0' || strcmp(end, "s") == 0) unit = 1;
+      else if (strcmp(end, "m") == 0) unit = 60;
+      else if (strcmp(end, "h") == 0) unit = 60 * 60;
+      else if (strcmp(end, "d") == 0) unit = 24 * 60 * 60;
+    }
+    if (unit == 0) {
+      fprintf(stderr, "sleep: invalid time interval '%s'\n", args[i]);
+      return EXIT_FAILURE;
+    }
+    total += value * unit;
+  }
+
+  // about 31 million years is plenty
+  if (total > 1e15) {
+    total = 1e15;
+  }
+  struct timespec left;
+  left.tv_sec = (time_t)total;
+  left.tv_nsec = (long)((total - (double)left.tv_sec) * 1e9);
+  // a SIGCHLD from a background job mustn't cut the sleep short
+  while (nanosleep(&left, &left) != 0 && errno == EINTR) {
+  }
+  return EXIT_SUCCESS;
+}
+
+/* printf */
+
+// reads a numeric printf argument. 'c or "c give the character's value.
+// Bad numbers are reported and count as far as they could be read.
+static long long printf_number(const char *arg, int *status) {
+  if (arg[0] == '\'' || arg[0] == '"') {
+    return (unsigned char)arg[1];
+  }
+  char *end;
+  errno = 0;
+  long long value;
+  if (arg[0] == '-') {
+    value = strtoll(arg, &end, 0);
+  } else {
+    // so 0xffffffffffffffff works for %x
+    value = (long long)strtoull(arg, &end, 0);
+  }
+  if (end == arg || *end != '\0' || errno == ERANGE) {
+    fprintf(stderr, "printf: '%s': expected a numeric value\n", arg);
+    *status = EXIT_FAILURE;
+  }
+  return value;
+}
+
+static long double printf_float(const char *arg, int *status) {
+  if (arg[0] == '\'' || arg[0] == '"') {
+    return (unsigned char)arg[1];
+  }
+  char *end;
+  long double value = strtold(arg, &end);
+  if (end == arg || *end != '\0') {
+    fprintf(stderr, "printf: '%s': expected a numeric value\n", arg);
+    *status = EXIT_FAILURE;
+  }
+  return value;
+}
+
+/*
+Goes through format once, taking args as conversions need them. Missing
+args count as "" or 0. Returns 1 if output should stop, after a \c or a
+bad conversion.
+*/
+static int format_once(Writer *w, const char *format, char ***next_arg,
+                       char **end_arg, int *status) {
+#define NEXT_ARG() (*next_arg < end_arg ? *(*next_arg)++ : NULL)
+  for (const char *p = format; *p; p++) {
+    if (*p == '\\' && p[1] != '\0') {
+      int stop = 0;
+      char c;
+      size_t used = expand_escape(&c, p + 1, 1, &stop);
+      if (stop) {
+        return 1;
+      }
+      put_char(w, c);
+      p += used;
+      continue;
+    }
+    if (*p != '%') {
+      put_char(w, *p);
+      continue;
+    }
+    if (p[1] == '%') {
+      put_char(w, '%');
+      p++;
+      continue;
+    }
+
+    // %[flags][width][.precision]conversion, rebuilt as a C format
+    char spec[16];
+    int spec_len = 0;
+    spec[spec_len++] = '%';
+    p++;
+    while (*p && strchr("-+ #0", *p) && spec_len < 8) {
+      spec[spec_len++] = *p++;
+    }
+
+    int width = 0, have_width = 0;
+    if (*p == '*') {
+      const char *arg = NEXT_ARG();
+      width = arg ? (int)printf_number(arg, status) : 0;
+      have_width = 1;
+      p++;
+    } else if (*p >= '0' && *p <= '9') {
+      width = (int)strtol(p, (char **)&p, 10);
+      have_width = 1;
+    }
+    int precision = 0, have_precision = 0;
+    if (*p == '.') {
+      p++;
+      have_precision = 1;
+      if (*p == '*') {
+        const char *arg = NEXT_ARG();
+        precision = arg ? (int)printf_number(arg, status) : 0;
+        p++;
+      } else {
+        precision = (int)strtol(p, (char **)&p, 10);
+      }
+    }
+    if (have_width) {
+      spec[spec_len++] = '*';
+    }
+    if (have_precision) {
+      spec[spec_len++] = '.';
+      spec[spec_len++] = '*';
+    }
+
+    char conversion = *p;
+    if (conversion == '\0' || !strchr("diouxXfFeEgGaAcsb", conversion)) {
+      fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+      *status = EXIT_FAILURE;
+      return 1;
+    }
+
+    const char *arg = NEXT_ARG();
+    char *expanded = NULL;
+    int stop = 0;
+    if (conversion == 'b') {
+      // %b is %s with the arg's escapes expanded, which only shrinks it
+      expanded = malloc((arg ? strlen(arg) : 0) + 1);
+      if (expanded == NULL) {
+        return 1;
+      }
+      size_t len = 0;
+      for (const char *s = arg ? arg : ""; *s && !stop; s++) {
+        char c = *s;
+        if (c == '\\' && s[1] != '\0') {
+          s += expand_escape(&c, s + 1, 0, &stop);
+          if (stop) {
+            break;
+          }
+        }
+        expanded[len++] = c;
+      }
+      expanded[len] = '\0';
+      arg = expanded;
+      conversion = 's';
+    }
+
+    switch (conversion) {
+    case 'c':
+      if (arg == NULL || arg[0] == '\0') {
+        break;
+      }
+      // precision means nothing for %c, and .* would take an arg we don't pass
+      if (have_precision) {
+        spec_len -= 2;
+      }
+      spec[spec_len++] = 'c';
+      spec[spec_len] = '\0';
+      if (have_width) put_formatted(w, spec, width, arg[0]);
+      else put_formatted(w, spec, arg[0]);
+      break;
+    case 's':
+      spec[spec_len++] = 's';
+      spec[spec_len] = '\0';
+      if (arg == NULL) arg = "";
+      if (have_width && have_precision) put_formatted(w, spec, width, precision, arg);
+      else if (have_width) put_formatted(w, spec, width, arg);
+      else if (have_precision) put_formatted(w, spec, precision, arg);
+      else put(w, arg, strlen(arg));
+      break;
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X': {
+      long long value = arg ? printf_number(arg, status) : 0;
+      spec[spec_len++] = 'l';
+      spec[spec_len++] = 'l';
+      spec[spec_len++] = conversion;
+      spec[spec_len] = '\0';
+      if (have_width && have_precision) put_formatted(w, spec, width, precision, value);
+      else if (have_width) put_formatted(w, spec, width, value);
+      else if (have_precision) put_formatted(w, spec, precision, value);
+      else put_formatted(w, spec, value);
+      break;
+    }
+    default: {
+      long double value = arg ? printf_float(arg, status) : 0;
+      spec[spec_len++] = 'L';
+      spec[spec_len++] = conversion;
+      spec[spec_len] = '\0';
+      if (have_width && have_precision) put_formatted(w, spec, width, precision, value);
+      else if (have_width) put_formatted(w, spec, width, value);
+      else if (have_precision) put_formatted(w, spec, precision, value);
+      else put_formatted(w, spec, value);
+      break;
+    }
+    }
+    free(expanded);
+    if (stop) {
+      return 1;
+    }
+  }
+  return 0;
+#undef NEXT_ARG
+}
+
+/*
+printf format [arg...]
+The format is used again while args are left, like POSIX printf.
+*/
+int builtin_printf(int num_args, char **args, Stream *out) {
+  if (num_args < 2) {
+    fprintf(stderr, "printf: missing format\n");
+    return EXIT_FAILURE;
+  }
+  char **next_arg = args + 2;
+  char **end_arg = args + num_args;
+  int status = EXIT_SUCCESS;
+
+  Writer w;
+  writer_init(&w, out);
+  while (1) {
+    char **before = next_arg;
+    if (format_once(&w, args[1], &next_arg, end_arg, &status) ||
+        next_arg == end_arg || next_arg == before) {
+      break;
+    }
+  }
+  writer_flush(&w);
+  return w.failed ? EXIT_FAILURE : status;
+}
+
+/* test and [ */
+
+#define TEST_TRUE 0
+#define TEST_FALSE 1
+#define TEST_ERROR 2
+
+#define STAT_CACHE_SIZE 8
+
+// stat() results for the current line, keyed by the path arg
+typedef struct {
+  const char *path;
+  int follow; // stat(), not lstat()
+  int result;
+  struct stat st;
+} StatEntry;
+
+static StatEntry stat_cache[STAT_CACHE_SIZE];
+static int stat_cached = 0;
+static int stat_next = 0;
+
+void builtin_test_forget(void) {
+  stat_cached = 0;
+  stat_next = 0;
+}
+
+static int cached_stat(const char *path, int follow, struct stat *st) {
+  for (int i = 0; i < stat_cached; i++) {
+    if (stat_cache[i].follow == follow &&
+        strcmp(stat_cache[i].path, path) == 0) {
+      *st = stat_cache[i].st;
+      return stat_cache[i].result;
+    }
+  }
+  int result = follow ? stat(path, st) : lstat(path, st);
+  StatEntry *entry = &stat_cache[stat_next];
+  stat_next = (stat_next + 1) % STAT_CACHE_SIZE;
+  if (stat_cached < STAT_CACHE_SIZE) {
+    stat_cached++;
+  }
+  entry->path = path;
+  entry->follow = follow;
+  entry->result = result;
+  entry->st = *st;
+  return result;
+}
+
+static int to_test(int condition) { return condition ? TEST_TRUE : TEST_FALSE; }
+
+static int negate(int result) {
+  return result == TEST_ERROR ? result : to_test(result == TEST_FALSE);
+}
+
+static int is_unary(const char *op) {
+  return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+         strchr("bcdefghkLnprsStuwxz", op[1]) != NULL;
+}
+
+static const char *BINARY_OPS[] = {"=",   "!=",  "-eq", "-ne", "-gt", "-ge",
+                                   "-lt", "-le", "-nt", "-ot", "-ef"};
+
+static int is_binary(const char *op) {
+  for (size_t i = 0; i < sizeof(BINARY_OPS) / sizeof(BINARY_OPS[0]); i++) {
+    if (strcmp(op, BINARY_OPS[i]) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int get_integer(const char *arg, long long *value) {
+  char *end;
+  errno = 0;
+  *value = strtoll(arg, &end, 10);
+  while (*end == ' ' || *end == '\t') {
+    end++;
+  }
+  if (end == arg || *end != '\0' || errno == ERANGE) {
+    fprintf(stderr, "test: %s: integer expected\n", arg);
+    return -1;
+  }
+  return 0;
+}
+
+static int unary(const char *op, const char *arg) {
+  struct stat st;
+  switch (op[1]) {
+  case 'n': return to_test(arg[0] != '\0');
+  case 'z': return to_test(arg[0] == '\0');
+  case 'r': return to_test(access(arg, R_OK) == 0);
+  case 'w': return to_test(access(arg, W_OK) == 0);
+  case 'x': return to_test(access(arg, X_OK) == 0);
+  case 't': {
+    long long fd;
+    if (get_integer(arg, &fd) != 0) {
+      return TEST_ERROR;
+    }
+    return to_test(fd >= 0 && fd <= 1024 && isatty((int)fd));
+  }
+  case 'h':
+  case 'L':
+    return to_test(cached_stat(arg, 0, &st) == 0 && S_ISLNK(st.st_mode));
+  }
+
+  if (cached_stat(arg, 1, &st) != 0) {
+    return TEST_FALSE;
+  }
+  switch (op[1]) {
+  case 'b': return to_test(S_ISBLK(st.st_mode));
+  case 'c': return to_test(S_ISCHR(st.st_mode));
+  case 'd': return to_test(S_ISDIR(st.st_mode));
+  case 'e': return TEST_TRUE;
+  case 'f': return to_test(S_ISREG(st.st_mode));
+  case 'g': return to_test(st.st_mode & S_ISGID);
+  case 'k': return to_test(st.st_mode & S_ISVTX);
+  case 'p': return to_test(S_ISFIFO(st.st_mode));
+  case 's': return to_test(st.st_size > 0);
+  case 'S': return to_test(S_ISSOCK(st.st_mode));
+  case 'u': return to_test(st.st_mode & S_ISUID);
+  }
+  return TEST_ERROR;
+}
+
+static int newer(const struct stat *a, const struct stat *b) {
+  if (a->st_mtim.tv_sec != b->st_mtim.tv_sec) {
+    return a->st_mtim.tv_sec > b->st_mtim.tv_sec;
+  }
+  return a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+}
+
+static int binary(const char *left, const char *op, const char *right) {
+  if (strcmp(op, "=") == 0) {
+    return to_test(strcmp(left, right) == 0);
+  }
+  if (strcmp(op, "!=") == 0) {
+    return to_test(strcmp(left, right) != 0);
+  }
+
+  if (op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+    struct stat a, b;
+    int have_a = cached_stat(left, 1, &a) == 0;
+    int have_b = cached_stat(right, 1, &b) == 0;
+    if (strcmp(op, "-nt") == 0) {
+      return to_test(have_a && (!have_b || newer(&a, &b)));
+    }
+    if (strcmp(op, "-ot") == 0) {
+      return to_test(have_b && (!have_a || newer(&b, &a)));
+    }
+    return to_test(have_a && have_b && a.st_dev == b.st_dev &&
+                   a.st_ino == b.st_ino);
+  }
+
+  long long a, b;
+  if (get_integer(left, &a) != 0 || get_integer(right, &b) != 0) {
+    return TEST_ERROR;
+  }
+  if (strcmp(op, "-eq") == 0) return to_test(a == b);
+  if (strcmp(op, "-ne") == 0) return to_test(a != b);
+  if (strcmp(op, "-gt") == 0) return to_test(a > b);
+  if (strcmp(op, "-ge") == 0) return to_test(a >= b);
+  if (strcmp(op, "-lt") == 0) return to_test(a < b);
+  return to_test(a <= b);
+}
+
+// recursive descent for the long forms, -a binds tighter than -o
+typedef struct {
+  char **args;
+  int count;
+  int pos;
+} TestParser;
+
+static int parse_or(TestParser *parser);
+
+static int parse_primary(TestParser *parser) {
+  char **args = parser->args + parser->pos;
+  int left = parser->count - parser->pos;
+  if (left <= 0) {
+    fprintf(stderr, "test: argument expected\n");
+    return TEST_ERROR;
+  }
+  if (strcmp(args[0], "(") == 0) {
+    parser->pos++;
+    int result = parse_or(parser);
+    if (parser->pos >= parser->count ||
+        strcmp(parser->args[parser->pos], ")") != 0) {
+      fprintf(stderr, "test: ')' expected\n");
+      return TEST_ERROR;
+    }
+    parser->pos++;
+    return result;
+  }
+  if (left >= 3 && is_binary(args[1])) {
+    parser->pos += 3;
+    return binary(args[0], args[1], args[2]);
+  }
+  if (left >= 2 && is_unary(args[0])) {
+    parser->pos += 2;
+    return unary(args[0], args[1]);
+  }
+  parser->pos++;
+  return to_test(args[0][0] != '\0');
+}
+
+static int parse_not(TestParser *parser) {
+  if (parser->pos < parser->count &&
+      strcmp(parser->args[parser->pos], "!") == 0) {
+    parser->pos++;
+    return negate(parse_not(parser));
+  }
+  return parse_primary(parser);
+}
+
+static int parse_and(TestParser *parser) {
+  int result = parse_not(parser);
+  while (result != TEST_ERROR && parser->pos < parser->count &&
+         strcmp(parser->args[parser->pos], "-a") == 0) {
+    parser->pos++;
+    int right = parse_not(parser);
+    result = right == TEST_ERROR
+                 ? right
+                 : to_test(result == TEST_TRUE && right == TEST_TRUE);
+  }
+  return result;
+}
+
+static int parse_or(TestParser *parser) {
+  int result = parse_and(parser);
+  while (result != TEST_ERROR && parser->pos < parser->count &&
+         strcmp(parser->args[parser->pos], "-o") == 0) {
+    parser->pos++;
+    int right = parse_and(parser);
+    result = right == TEST_ERROR
+                 ? right
+                 : to_test(result == TEST_TRUE || right == TEST_TRUE);
+  }
+  return result;
+}
+
+// POSIX decides up to four args by how many there are, so that things like
+// test -n or test ! = ! mean what they say. More go to the parser.
+static int evaluate(char **args, int count) {
+  switch (count) {
+  case 0:
+    return TEST_FALSE;
+  case 1:
+    return to_test(args[0][0] != '\0');
+  case 2:
+    if (strcmp(args[0], "!") == 0) {
+      return negate(evaluate(args + 1, 1));
+    }
+    if (is_unary(args[0])) {
+      return unary(args[0], args[1]);
+    }
+    fprintf(stderr, "test: %s: unary operator expected\n", args[0]);
+    return TEST_ERROR;
+  case 3:
+    if (is_binary(args[1])) {
+      return binary(args[0], args[1], args[2]);
+    }
+    if (strcmp(args[1], "-a") == 0) {
+      return to_test(args[0][0] != '\0' && args[2][0] != '\0');
+    }
+    if (strcmp(args[1], "-o") == 0) {
+      return to_test(args[0][0] != '\0' || args[2][0] != '\0');
+    }
+    if (strcmp(args[0], "!") == 0) {
+      return negate(evaluate(args + 1, 2));
+    }
+    if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0) {
+      return evaluate(args + 1, 1);
+    }
+    fprintf(stderr, "test: %s: binary operator expected\n", args[1]);
+    return TEST_ERROR;
+  case 4:
+    if (strcmp(args[0], "!") == 0) {
+      return negate(evaluate(args + 1, 3));
+    }
+    if (strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0) {
+      return evaluate(args + 1, 2);
+    }
+    break;
+  }
+
+  TestParser parser = {args, count, 0};
+  int result = parse_or(&parser);
+  if (result != TEST_ERROR && parser.pos != count) {
+    fprintf(stderr, "test: %s: unexpected argument\n", args[parser.pos]);
+    return TEST_ERROR;
+  }
+  return result;
+}
+
+int builtin_test(int num_args, char **args) {
+  int count = num_args - 1;
+  if (strcmp(args[0], "[") == 0) {
+    if (count == 0 || strcmp(args[num_args - 1], "]") != 0) {
+      fprintf(stderr, "[: missing ]\n");
+      return TEST_ERROR;
+    }
+    count--;
+  }
+  return evaluate(args + 1, count);
+}
+
+/* cat and cp */
+
+#define COPY_CHUNK (1 << 20)      // asked of the kernel per call
+#define COPY_BUFFER (128 * 1024)  // for the read/write fallback
+
+enum { COPY_RANGE, COPY_SPLICE, COPY_SENDFILE, COPY_LOOP };
+
+// errors that mean "this call can't do these two fds", not "the copy failed"
+static int unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP ||
+         err == EBADF || err == ESPIPE;
+}
+
+static int copy_loop(Stream *in, Stream *out) {
+  char *buf = malloc(COPY_BUFFER);
+  if (buf == NULL) {
+    return -1;
+  }
+  int result = 0;
+  for (;;) {
+    ssize_t n = stream_read(in, buf, COPY_BUFFER);
+    if (n <= 0) {
+      result = n < 0 ? -1 : 0;
+      break;
+    }
+    if (stream_write(out, buf, n) != n) {
+      result = -1;
+      break;
+    }
+  }
+  int saved = errno;
+  free(buf);
+  errno = saved;
+  return result;
+}
+
+/*
+Copies in_fd to out_fd until EOF, through the kernel when it can:
+copy_file_range between regular files (a reflink or a server-side copy on
+filesystems that have them), splice when either end is a pipe, sendfile
+from a regular file to anything else. A call the fds don't support drops
+to the next one, down to a plain read/write loop. They all move the fds'
+own offsets, so switching mid-copy is fine. Regular files that say they
+are empty, like most of /proc, are read with the loop.
+Returns 0, or -1 with errno set.
+*/
+static int copy_fd(int in_fd, int out_fd) {
+  struct stat in_st, out_st;
+  int in_regular = 0, in_pipe = 0, out_regular = 0, out_pipe = 0;
+  if (fstat(in_fd, &in_st) == 0) {
+    in_regular = S_ISREG(in_st.st_mode) && in_st.st_size > 0;
+    in_pipe = S_ISFIFO(in_st.st_mode);
+  }
+  if (fstat(out_fd, &out_st) == 0) {
+    out_regular = S_ISREG(out_st.st_mode);
+    out_pipe = S_ISFIFO(out_st.st_mode);
+  }
+
+  int method = COPY_LOOP;
+  if (in_regular && out_regular) {
+    method = COPY_RANGE;
+  } else if (in_pipe || out_pipe) {
+    method = COPY_SPLICE;
+  } else if (in_regular) {
+    method = COPY_SENDFILE;
+  }
+
+  for (;;) {
+    ssize_t n;
+    switch (method) {
+    case COPY_RANGE:
+      n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+      break;
+    case COPY_SPLICE:
+      n = splice(in_fd, NULL, out_fd, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+      break;
+    case COPY_SENDFILE:
+      n = sendfile(out_fd, in_fd, NULL, COPY_CHUNK);
+      break;
+    default: {
+      Stream in = {in_fd, NULL}, out = {out_fd, NULL};
+      return copy_loop(&in, &out);
+    }
+    }
+    if (n == 0) {
+      return 0;
+    }
+    if (n > 0 || errno == EINTR) {
+      continue;
+    }
+    if (!unsupported(errno)) {
+      return -1;
+    }
+    method = (method != COPY_SENDFILE && in_regular) ? COPY_SENDFILE : COPY_LOOP;
+  }
+}
+
+// between two fds the kernel can do the copy, rings go through a buffer
+int builtin_copy(Stream *in, Stream *out) {
+  if (in->ring == NULL && out->ring == NULL) {
+    // the kernel writes to the fd itself, after what is buffered for it
+    if (out->buffered && output_flush() != 0) {
+      return -1;
+    }
+    return copy_fd(in->fd, out->fd);
+  }
+  return copy_loop(in, out);
+}
+
+// cat's only POSIX option, -u, is what it always does anyway
+int builtin_cat_takes(int num_args, char **args) {
+  for (int i = 1; i < num_args; i++) {
+    if (args[i][0] == '-' && args[i][1] != '\0' && strcmp(args[i], "-u") != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int builtin_cat(int num_args, char **args, Stream *in, Stream *out) {
+  // anything the shell printf()ed before has to come out first
+  fflush(stdout);
+  int result = EXIT_SUCCESS;
+  int files = 0;
+  for (int i = 1; i < num_args; i++) {
+    if (strcmp(args[i], "-u") == 0) {
+      continue;
+    }
+    files++;
+    Stream file = *in;
+    if (strcmp(args[i], "-") != 0) {
+      file.fd = open(args[i], O_RDONLY | O_CLOEXEC);
+      file.ring = NULL;
+      if (file.fd < 0) {
+        fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+        result = EXIT_FAILURE;
+        continue;
+      }
+    }
+    int broken = 0;
+    if (builtin_copy(&file, out) != 0) {
+      // a gone reader ends cat quietly, like /bin/cat dying of SIGPIPE
+      broken = errno == EPIPE;
+      if (!broken) {
+        fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+      }
+      result = EXIT_FAILURE;
+    }
+    if (file.ring == NULL && file.fd != in->fd) {
+      close(file.fd);
+    }
+    if (broken) {
+      break;
+    }
+  }
+  if (files == 0 && builtin_copy(in, out) != 0) {
+    if (errno != EPIPE) {
+      fprintf(stderr, "cat: -: %s\n", strerror(errno));
+    }
+    result = EXIT_FAILURE;
+  }
+  return result;
+}
+
+static int cp_one(const char *from, const char *to) {
+  int in = open(from, O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    fprintf(stderr, "cp: cannot stat '%s': %s\n", from, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  struct stat in_st, out_st;
+  if (fstat(in, &in_st) != 0 || S_ISDIR(in_st.st_mode)) {
+    fprintf(stderr, "cp: -r not specified; omitting directory '%s'\n", from);
+    close(in);
+    return EXIT_FAILURE;
+  }
+  if (stat(to, &out_st) == 0 && out_st.st_dev == in_st.st_dev &&
+      out_st.st_ino == in_st.st_ino) {
+    fprintf(stderr, "cp: '%s' and '%s' are the same file\n", from, to);
+    close(in);
+    return EXIT_FAILURE;
+  }
+  int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, in_st.st_mode & 0777);
+  if (out < 0) {
+    fprintf(stderr, "cp: cannot create regular file '%s': %s\n", to, strerror(errno));
+    close(in);
+    return EXIT_FAILURE;
+  }
+  int result = EXIT_SUCCESS;
+  if (copy_fd(in, out) != 0) {
+    fprintf(stderr, "cp: error copying '%s' to '%s': %s\n", from, to, strerror(errno));
+    result = EXIT_FAILURE;
+  }
+  close(in);
+  if (close(out) != 0 && result == EXIT_SUCCESS) {
+    fprintf(stderr, "cp: error writing '%s': %s\n", to, strerror(errno));
+    result = EXIT_FAILURE;
+  }
+  return result;
+}
+
+// options are left to /bin/cp
+int builtin_cp_takes(int num_args, char **args) {
+  for (int i = 1; i < num_args; i++) {
+    if (args[i][0] == '-') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+cp from to
+cp from... dir
+*/
+int builtin_cp(int num_args, char **args) {
+  if (num_args < 3) {
+    fprintf(stderr, "cp: missing %s operand\n", num_args < 2 ? "file" : "destination file");
+    return EXIT_FAILURE;
+  }
+  const char *target = args[num_args - 1];
+  struct stat st;
+  int to_dir = stat(target, &st) == 0 && S_ISDIR(st.st_mode);
+  if (!to_dir) {
+    if (num_args > 3) {
+      fprintf(stderr, "cp: target '%s' is not a directory\n", target);
+      return EXIT_FAILURE;
+    }
+    return cp_one(args[1], target);
+  }
+
+  int result = EXIT_SUCCESS;
+  for (int i = 1; i < num_args - 1; i++) {
+    const char *base = strrchr(args[i], '/');
+    base = base == NULL ? args[i] : base + 1;
+    size_t len = strlen(target) + strlen(base) + 2;
+    char *to = malloc(len);
+    if (to == NULL) {
+      perror("malloc failed");
+      return EXIT_FAILURE;
+    }
+    snprintf(to, len, "%s/%s", target, base);
+    if (cp_one(args[i], to) != EXIT_SUCCESS) {
+      result = EXIT_FAILURE;
+    }
+    free(to);
+  }
+  return result;
+}
@@ -0,0 +1,32 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "ring.h"
+
+// Builtins that stand in for programs in /bin, so the commands scripts run
+// most don't cost a fork and an exec. They behave like the POSIX programs:
+// output goes to out and the return value is the program's exit status.
+
+int builtin_echo(int num_args, char **args, Stream *out);
+int builtin_printf(int num_args, char **args, Stream *out);
+int builtin_sleep(int num_args, char **args);
+
+// cat and cp copy through the kernel (copy_file_range, splice, sendfile)
+// where the fds allow it. The _takes functions say whether the builtin does
+// these options, when it doesn't the caller runs the real program instead.
+int builtin_cat_takes(int num_args, char **args);
+int builtin_cat(int num_args, char **args, Stream *in, Stream *out);
+int builtin_cp_takes(int num_args, char **args);
+int builtin_cp(int num_args, char **args);
+
+// copies in to out until EOF the way cat does, 0 or -1 with errno set
+int builtin_copy(Stream *in, Stream *out);
+
+// test and [, args[0] says which. 0 true, 1 false, 2 for a bad expression.
+int builtin_test(int num_args, char **args);
+
+// test remembers stat() results for the rest of the line. execute() drops
+// them before every line, since the args they are keyed by go away with it.
+void builtin_test_forget(void);
+
+#endif
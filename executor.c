@@ -1,43 +1,131 @@
+#define _GNU_SOURCE
+#include "executor.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "memo.h"
+#include "output.h"
 #include "parser.h"
+#include "path_cache.h"
+#include "spawner.h"
+#include "trace.h"
+#include "vars.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
 
 #define BUFFER_SIZE 1024 // 1kb
 
-char *BUILTIN[] = {"cd", "pwd", "which", "exit", "die"};
+// per-stage exit statuses of the last foreground command, like bash's
+// PIPESTATUS. pipefail makes a pipeline fail if any stage failed, not just
+// the last one.
+static int *pipestatus = NULL;
+static int pipestatus_len = 0;
+static int pipefail = 0;
 
-//finds if a file exists 
-char *findFunction(char *function) {
+// how a pipeline stage runs. A lone builtin runs in the shell itself
+enum { STAGE_PROGRAM, STAGE_FORK, STAGE_THREAD, STAGE_SHELL };
+
+typedef struct {
+  Command *command;
+  const Builtin *builtin; // NULL for a program
+  const char *path;       // a program's path, owned by the path cache
+  int kind;
+  Stream in;
+  Stream out;
+  int own_in;             // in and out are pipeline ends the stage closes
+  int own_out;
+  pid_t pid;
+  pthread_t thread;
+  int started;            // the thread is running
+  int status;             // a thread's exit status
+  struct rusage usage;    // what the stage used, filled in under time
+} Stage;
+
+// set while a line that starts with time runs
+static int timing = 0;
+
+// per-stage scratch for run_pipeline(). These only grow, so running a line
+// costs no allocation once the longest pipeline has been seen.
+static Stage *stages = NULL;
+static int stages_cap = 0;
+
+static int reset_pipestatus(int len) {
+  if (len > stages_cap) {
+    int *statuses = realloc(pipestatus, len * sizeof(int));
+    if (statuses != NULL) {
+      pipestatus = statuses;
+    }
+    Stage *more = realloc(stages, len * sizeof(Stage));
+    if (more != NULL) {
+      stages = more;
+    }
+    if (statuses == NULL || more == NULL) {
+      pipestatus_len = 0;
+      return -1;
+    }
+    stages_cap = len;
+  }
+  for (int i = 0; i < len; i++) {
+    pipestatus[i] = EXIT_FAILURE;
+  }
+  pipestatus_len = len;
+  return 0;
+}
+
+const int *get_pipestatus(int *count) {
+  *count = pipestatus_len;
+  return pipestatus;
+}
+
+void set_pipefail(int enabled) { pipefail = enabled; }
+
+int get_pipefail(void) { return pipefail; }
+
+// the exit event of a reaped child
+static void trace_exit(pid_t pid, int stage, int status) {
+  trace_event("exit", "\"child\":%d,\"stage\":%d,\"status\":%d,\"signal\":%d",
+              (int)pid, stage, WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+              WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+}
+
+// turn a wait status into the value execute() reports
+static int decode_status(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  return EXIT_FAILURE;
+}
+
+//finds if a file exists, names without a '/' are looked up through the
+//path cache. The result belongs to the cache, don't free it.
+const char *findFunction(char *function) {
   if (strchr(function, '/') != NULL) {
     if (access(function, X_OK) == 0) {
-      char *result = malloc(strlen(function) + 1);
-      if (result == NULL) {
-        return NULL;
-      }
-      strcpy(result, function);
-      return result;
-    }
-  }
-  char buffer[BUFFER_SIZE];
-  char *directories[] = {"/usr/local/bin", "/usr/bin", "/bin"};
-  for (int i = 0; i < 3; i++) {
-    snprintf(buffer, BUFFER_SIZE, "%s/%s", directories[i], function);
-    // check that the file exists and is executable
-    if (access(buffer, X_OK) == 0) {
-      char *result = malloc(strlen(buffer) + 1);
-      if (result == NULL) {
-        return NULL;
-      }
-      strcpy(result, buffer);
-      return result;
+      return function;
     }
+    return NULL;
   }
-
-  return NULL;
+  const char *path = path_cache_lookup(function);
+  if (trace_enabled) {
+    char name[256], found[512];
+    trace_event("lookup", "\"name\":\"%s\",\"path\":\"%s\"",
+                trace_escape(function, name, sizeof(name)),
+                trace_escape(path != NULL ? path : "", found, sizeof(found)));
+  }
+  return path;
 }
 
 int cd(char *destination) { 
@@ -48,59 +136,1020 @@ int cd(char *destination) {
   return EXIT_SUCCESS;
 }
 
-int pwd(int fd) {
+int pwd(Stream *out) {
   char *buffer = malloc(BUFFER_SIZE * sizeof(char));
   if (buffer == NULL) {
     perror("malloc failed");
     return EXIT_FAILURE;
   }
-  if (getcwd(buffer, BUFFER_SIZE) == NULL) {
+  if (getcwd(buffer, BUFFER_SIZE - 1) == NULL) {
     free(buffer);
     return EXIT_FAILURE;
   }
-  write(fd, buffer, strlen(buffer));
-  write(fd, "\n", 1);
+  size_t len = strlen(buffer);
+  buffer[len++] = '\n';
+  int result = stream_write(out, buffer, len) == (ssize_t)len ? EXIT_SUCCESS : EXIT_FAILURE;
   free(buffer);
-  return EXIT_SUCCESS;
+  return result;
 }
 
-int which(char *function) {
-  //If the argument to which is a builtin function, fail
-  if (strcmp(function, "cd") == 0 || strcmp(function, "pwd") == 0 || strcmp(function, "which") == 0 || strcmp(function, "exit") == 0 || strcmp(function, "die") == 0) {
+int which(char *function, Stream *out) {
+  //If the argument to which is a builtin function, fail. Builtins that stand
+  //in for a program (echo, test, ...) still show where the program is
+  const Builtin *builtin = find_builtin(function);
+  if (builtin != NULL && !(builtin->flags & BUILTIN_STANDIN)) {
     return EXIT_FAILURE;
   } else {
-    char *path = findFunction(function);
+    const char *path = findFunction(function);
     if (path == NULL){
       return EXIT_FAILURE;
     }
-    printf("%s\n", path);
-    free(path);
+    size_t len = strlen(path);
+    char *line = malloc(len + 1);
+    if (line == NULL) {
+      return EXIT_FAILURE;
+    }
+    memcpy(line, path, len);
+    line[len] = '\n';
+    ssize_t written = stream_write(out, line, len + 1);
+    free(line);
+    if (written != (ssize_t)len + 1) {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// set -o pipefail / set +o pipefail
+int set(int num_args, char **args) {
+  if (num_args != 3 || strcmp(args[2], "pipefail") != 0) {
+    fprintf(stderr, "usage: set -o|+o pipefail\n");
+    return EXIT_FAILURE;
+  }
+  if (strcmp(args[1], "-o") == 0) {
+    set_pipefail(1);
+  } else if (strcmp(args[1], "+o") == 0) {
+    set_pipefail(0);
+  } else {
+    fprintf(stderr, "usage: set -o|+o pipefail\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/*
+hash          lists the cached command paths
+hash -r       forgets every cached path
+hash -s       prints the cache hit and miss counters
+hash name...  looks the names up now so later commands hit the cache
+*/
+int hash(int num_args, char **args, int fd) {
+  //these write to fd itself
+  output_flush();
+  if (num_args == 1) {
+    path_cache_print(fd);
+    return EXIT_SUCCESS;
+  }
+  if (num_args == 2 && strcmp(args[1], "-r") == 0) {
+    path_cache_clear();
+    return EXIT_SUCCESS;
+  }
+  if (num_args == 2 && strcmp(args[1], "-s") == 0) {
+    PathCacheStats stats;
+    path_cache_stats(&stats);
+    dprintf(fd, "hits %lu misses %lu entries %d negative %d\n", stats.hits,
+            stats.misses, stats.entries, stats.negative);
+    return EXIT_SUCCESS;
+  }
+  int result = EXIT_SUCCESS;
+  for (int i = 1; i < num_args; i++) {
+    if (args[i][0] == '-' || strchr(args[i], '/') != NULL || path_cache_seed(args[i]) != 0) {
+      fprintf(stderr, "hash: %s: not found\n", args[i]);
+      result = EXIT_FAILURE;
+    }
+  }
+  return result;
+}
+
+/*
+wait          waits for every background job, succeeds
+wait -n       waits for the next job to finish and returns its status
+wait id...    waits for the given jobs and returns the last one's status,
+              %n is a job number and anything else a pid
+*/
+int wait_jobs(int num_args, char **args) {
+  if (num_args == 1) {
+    jobs_wait_all();
+    return EXIT_SUCCESS;
+  }
+  int id, status;
+  if (num_args == 2 && strcmp(args[1], "-n") == 0) {
+    if (jobs_wait_next(&id, &status) != 0) {
+      return 127;
+    }
+    return decode_status(status);
+  }
+
+  int result = EXIT_SUCCESS;
+  for (int i = 1; i < num_args; i++) {
+    int by_pid = args[i][0] != '%';
+    char *end;
+    long value = strtol(args[i] + (by_pid ? 0 : 1), &end, 10);
+    if (*end != '\0' || value <= 0 ||
+        jobs_wait_one(value, by_pid, &status) != 0) {
+      fprintf(stderr, "wait: %s: no such job\n", args[i]);
+      result = 127;
+      continue;
+    }
+    result = decode_status(status);
+  }
+  return result;
+}
+
+// starts path and waits for it, returns the raw wait status or -1
+static int run_and_wait(const char *path, char **args, int in_fd, int out_fd) {
+  output_flush();
+  pid_t pid = spawn_command(path, args, in_fd, out_fd);
+  if (pid < 0) {
+    perror(args[0]);
+    return -1;
+  }
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      perror("waitpid");
+      return -1;
+    }
+  }
+  if (trace_enabled) {
+    trace_exit(pid, 0, status);
+  }
+  return status;
+}
+
+/*
+memo [-d file]... cmd args...   runs cmd, or replays the stdout and status
+                                it had last time with the same args, binary,
+                                input and -d files
+memo -s                         prints the hit and miss counters and the
+                                size of the store
+memo -r                         empties the store
+
+Only what cmd writes to stdout is kept, stderr isn't replayed. Without a <
+cmd reads /dev/null, a < file is part of the key, and with input from a
+pipe cmd just runs. So it does without a store (MYSH_CACHE_DIR unset), and
+when cmd is killed by a signal nothing is kept.
+*/
+int memo(int num_args, char **args, int in_fd, int out_fd) {
+  //everything below writes to out_fd itself
+  output_flush();
+  if (num_args == 2 && strcmp(args[1], "-s") == 0) {
+    MemoStats stats;
+    memo_stats(&stats);
+    dprintf(out_fd, "hits %lu misses %lu uncached %lu entries %d bytes %lld\n",
+            stats.hits, stats.misses, stats.uncached, stats.entries, stats.bytes);
+    return EXIT_SUCCESS;
+  }
+  if (num_args == 2 && strcmp(args[1], "-r") == 0) {
+    memo_clear();
+    return EXIT_SUCCESS;
+  }
+
+  // -d file pairs, then the command
+  int first = 1;
+  while (first + 1 < num_args && strcmp(args[first], "-d") == 0) {
+    first += 2;
+  }
+  if (first >= num_args || args[first][0] == '-') {
+    fprintf(stderr, "usage: memo [-d file]... command [args...]\n");
+    return EXIT_FAILURE;
+  }
+  char **command = args + first;
+  const char *path = findFunction(command[0]);
+  if (path == NULL) {
+    fprintf(stderr, "command not found\n");
+    return EXIT_FAILURE;
+  }
+
+  // without a < cmd reads /dev/null, like a background job. a file is
+  // hashed, and a pipe can't be read without taking it from cmd
+  struct stat in_st;
+  int null_fd = -1;
+  if (in_fd == STDIN_FILENO) {
+    null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (null_fd < 0) {
+      perror("/dev/null");
+      return EXIT_FAILURE;
+    }
+    in_fd = null_fd;
+  }
+  int cacheable = memo_available() == 0 &&
+                  (in_fd == null_fd ||
+                   (fstat(in_fd, &in_st) == 0 && S_ISREG(in_st.st_mode)));
+  if (!cacheable) {
+    memo_uncached();
+    int status = run_and_wait(path, command, in_fd, out_fd);
+    if (null_fd >= 0) {
+      close(null_fd);
+    }
+    return status < 0 ? EXIT_FAILURE : decode_status(status);
+  }
+
+  // the -d files sit at every other place from args[2]
+  char **deps = malloc(num_args * sizeof(char *));
+  if (deps == NULL) {
+    perror("memo");
+    if (null_fd >= 0) {
+      close(null_fd);
+    }
+    return EXIT_FAILURE;
+  }
+  int num_deps = 0;
+  for (int i = 2; i < first; i += 2) {
+    deps[num_deps++] = args[i];
+  }
+  char key[33];
+  memo_key(command, path, in_fd == null_fd ? -1 : in_fd, deps, num_deps, key);
+  free(deps);
+
+  int result;
+  int entry = memo_find(key, &result);
+  TRACE("memo", "\"key\":\"%s\",\"hit\":%d", key, entry >= 0);
+  if (entry < 0) {
+    entry = memo_begin(key);
+    int status = run_and_wait(path, command, in_fd, entry >= 0 ? entry : out_fd);
+    result = status < 0 ? EXIT_FAILURE : decode_status(status);
+    if (entry >= 0 && (status < 0 || !WIFEXITED(status) ||
+                       memo_commit(entry, key, result) != 0)) {
+      // nothing is kept, what it wrote still has to come out
+      memo_abort(entry, key);
+    }
+    if (entry >= 0) {
+      memo_evict();
+    }
+  }
+  if (null_fd >= 0) {
+    close(null_fd);
+  }
+  if (entry >= 0) {
+    Stream from = {entry, NULL}, to = {out_fd, NULL};
+    if (builtin_copy(&from, &to) != 0 && errno != EPIPE) {
+      perror("memo");
+    }
+    close(entry);
+  }
+  return result;
+}
+
+// adapters so every builtin has the same signature. io says where its
+// output goes, and exit and die raise *io->should_exit
+static int builtin_cd(int num_args, char **args, BuiltinIO *io) {
+  (void)num_args;
+  (void)io;
+  return cd(args[1]);
+}
+
+static int builtin_pwd(int num_args, char **args, BuiltinIO *io) {
+  (void)num_args;
+  (void)args;
+  return pwd(&io->out);
+}
+
+//pipeline threads can run which side by side, and the path cache isn't
+//thread safe. The shell's own thread doesn't look anything up meanwhile
+static pthread_mutex_t which_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int builtin_which(int num_args, char **args, BuiltinIO *io) {
+  (void)num_args;
+  pthread_mutex_lock(&which_lock);
+  int result = which(args[1], &io->out);
+  pthread_mutex_unlock(&which_lock);
+  return result;
+}
+
+//exit doesn't care, exit is god, it succeeds :)
+static int builtin_exit(int num_args, char **args, BuiltinIO *io) {
+  (void)num_args;
+  (void)args;
+  *io->should_exit = 1;
+  return EXIT_SUCCESS;
+}
+
+//die will print all argument and fail, it is not god :(
+static int builtin_die(int num_args, char **args, BuiltinIO *io) {
+  *io->should_exit = 1;
+  for (int j = 1; j < num_args; j++) {
+    if (j > 1) stream_write(&io->out, " ", 1);
+    stream_write(&io->out, args[j], strlen(args[j]));
   }
+  if (num_args > 1) stream_write(&io->out, "\n", 1);
+  return EXIT_FAILURE;
+}
+
+static int builtin_set(int num_args, char **args, BuiltinIO *io) {
+  (void)io;
+  return set(num_args, args);
+}
+
+static int builtin_hash(int num_args, char **args, BuiltinIO *io) {
+  return hash(num_args, args, io->out.fd);
+}
+
+static int builtin_memo(int num_args, char **args, BuiltinIO *io) {
+  return memo(num_args, args, io->in.fd, io->out.fd);
+}
+
+static int builtin_wait(int num_args, char **args, BuiltinIO *io) {
+  (void)io;
+  return wait_jobs(num_args, args);
+}
+
+static int builtin_true(int num_args, char **args, BuiltinIO *io) {
+  (void)num_args;
+  (void)args;
+  (void)io;
   return EXIT_SUCCESS;
 }
 
+static int builtin_false(int num_args, char **args, BuiltinIO *io) {
+  (void)num_args;
+  (void)args;
+  (void)io;
+  return EXIT_FAILURE;
+}
+
+static int run_echo(int num_args, char **args, BuiltinIO *io) {
+  return builtin_echo(num_args, args, &io->out);
+}
+
+static int run_printf(int num_args, char **args, BuiltinIO *io) {
+  return builtin_printf(num_args, args, &io->out);
+}
+
+static int run_test(int num_args, char **args, BuiltinIO *io) {
+  (void)io;
+  return builtin_test(num_args, args);
+}
+
+static int run_sleep(int num_args, char **args, BuiltinIO *io) {
+  (void)io;
+  return builtin_sleep(num_args, args);
+}
+
+static int run_cat(int num_args, char **args, BuiltinIO *io) {
+  return builtin_cat(num_args, args, &io->in, &io->out);
+}
+
+static int run_cp(int num_args, char **args, BuiltinIO *io) {
+  (void)io;
+  return builtin_cp(num_args, args);
+}
+
+/*
+Every builtin, one entry each. Adding a builtin is adding a line here.
+min_args and max_args count the name itself, -1 is no limit, and usage is
+printed when the count is off. Stand-ins with a takes function leave the
+options they don't do to the program.
+*/
+static const Builtin BUILTINS[] = {
+  {"cd",     2,  2, "too many args in cd",           builtin_cd,    0},
+  {"pwd",    1,  1, "too many args in pwd",          builtin_pwd,   BUILTIN_IN_PROCESS},
+  {"which",  2,  2, "which only takes one argument", builtin_which, BUILTIN_IN_PROCESS},
+  {"exit",   1,  1, "exit takes no arguments",       builtin_exit,  0},
+  {"die",    1, -1, NULL,                            builtin_die,   0},
+  {"set",    1, -1, NULL,                            builtin_set,   0},
+  {"hash",   1, -1, NULL,                            builtin_hash,  0},
+  {"wait",   1, -1, NULL,                            builtin_wait,  0},
+  {"memo",   2, -1, "usage: memo [-d file]... command [args...]", builtin_memo, 0},
+  //stand-ins for /bin programs, run here to save a fork and an exec
+  {"echo",   1, -1, NULL, run_echo,      BUILTIN_STANDIN | BUILTIN_IN_PROCESS},
+  {"true",   1, -1, NULL, builtin_true,  BUILTIN_STANDIN | BUILTIN_IN_PROCESS},
+  {"false",  1, -1, NULL, builtin_false, BUILTIN_STANDIN | BUILTIN_IN_PROCESS},
+  {"test",   1, -1, NULL, run_test,      BUILTIN_STANDIN},
+  {"[",      1, -1, NULL, run_test,      BUILTIN_STANDIN},
+  {"sleep",  1, -1, NULL, run_sleep,     BUILTIN_STANDIN | BUILTIN_IN_PROCESS},
+  {"printf", 1, -1, NULL, run_printf,    BUILTIN_STANDIN | BUILTIN_IN_PROCESS},
+  {"cat",    1, -1, NULL, run_cat,       BUILTIN_STANDIN | BUILTIN_IN_PROCESS, builtin_cat_takes},
+  {"cp",     1, -1, NULL, run_cp,        BUILTIN_STANDIN | BUILTIN_IN_PROCESS, builtin_cp_takes},
+};
+
+#define NUM_BUILTINS ((int)(sizeof(BUILTINS) / sizeof(BUILTINS[0])))
+
+/*
+Lookup is a perfect hash: a seed is picked so that every name lands in its
+own slot, and finding a builtin is one hash of the name, one slot and one
+strcmp, however many builtins there are. Names that aren't builtins land in
+an empty slot or fail the strcmp. C has no way to run the search at compile
+time, so it runs on the first lookup. For this table it tries a handful of
+seeds.
+*/
+#define BUILTIN_SLOTS 64 // power of two, a few times the number of builtins
+
+static unsigned char builtin_slots[BUILTIN_SLOTS]; // index + 1, 0 is empty
+static uint32_t builtin_seed;
+static int builtin_slots_ready = 0;
+
+// FNV-1a from a seeded basis, folded down to a slot
+static uint32_t builtin_slot(const char *name, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (; *name != '\0'; name++) {
+    h ^= (unsigned char)*name;
+    h *= 16777619u;
+  }
+  return (h ^ (h >> 16)) & (BUILTIN_SLOTS - 1);
+}
+
+static void build_builtin_slots(void) {
+  for (uint32_t seed = 0; seed < (1u << 20); seed++) {
+    memset(builtin_slots, 0, sizeof(builtin_slots));
+    int i;
+    for (i = 0; i < NUM_BUILTINS; i++) {
+      uint32_t slot = builtin_slot(BUILTINS[i].name, seed);
+      if (builtin_slots[slot] != 0) {
+        break;
+      }
+      builtin_slots[slot] = i + 1;
+    }
+    if (i == NUM_BUILTINS) {
+      builtin_seed = seed;
+      builtin_slots_ready = 1;
+      return;
+    }
+  }
+  //only a much bigger table could get here, raise BUILTIN_SLOTS
+  fprintf(stderr, "mysh: no perfect hash for the builtin table\n");
+  abort();
+}
+
+const Builtin *find_builtin(const char *name) {
+  if (!builtin_slots_ready) {
+    build_builtin_slots();
+  }
+  int index = builtin_slots[builtin_slot(name, builtin_seed)];
+  if (index == 0 || strcmp(BUILTINS[index - 1].name, name) != 0) {
+    return NULL;
+  }
+  return &BUILTINS[index - 1];
+}
+
+// the builtin that runs command, or NULL when a program has to
+static const Builtin *builtin_for(Command *command) {
+  const Builtin *builtin = find_builtin(command->args[0]);
+  if (builtin != NULL && builtin->takes != NULL &&
+      !builtin->takes(command->num_args, command->args)) {
+    return NULL;
+  }
+  return builtin;
+}
+
+// checks the arg count, then runs the builtin
+static int run_builtin(const Builtin *builtin, Command *command, BuiltinIO *io) {
+  if (command->num_args < builtin->min_args ||
+      (builtin->max_args >= 0 && command->num_args > builtin->max_args)) {
+    if (builtin->usage != NULL) {
+      fprintf(stderr, "%s\n", builtin->usage);
+    }
+    return EXIT_FAILURE;
+  }
+  return builtin->run(command->num_args, command->args, io);
+}
+
+// runs a builtin stage of a pipeline inside its forked child, never returns.
+// in_fd is STDIN_FILENO when the stage reads the shell's own input, like
+// for a lone builtin. external stages are started with spawn_command()
+static void run_stage(const Builtin *builtin, Command *command, int in_fd) {
+  //exit, die, cd and set only change this child
+  int should_exit = 0;
+  BuiltinIO io = {{in_fd, NULL}, {STDOUT_FILENO, NULL}, &should_exit};
+  exit(run_builtin(builtin, command, &io));
+}
+
+// runs an external command and waits for it, usage gets its rusage
+static int run_program(char **args, int read_fd, int output_fd, struct rusage *usage) {
+  //look the path up in the parent so the cache sees it
+  const char *path = findFunction(args[0]);
+  if (path == NULL) {
+    fprintf(stderr, "command not found\n");
+    return EXIT_FAILURE;
+  }
+  output_flush();
+  pid_t pid = spawn_command(path, args, read_fd, output_fd);
+  if (pid < 0) {
+    perror(args[0]);
+    return EXIT_FAILURE;
+  }
+  int status;
+  while (wait4(pid, &status, 0, usage) < 0) {
+    if (errno != EINTR) {
+      perror("waitpid");
+      return EXIT_FAILURE;
+    }
+  }
+  if (trace_enabled) {
+    trace_exit(pid, 0, status);
+  }
+  return decode_status(status);
+}
+
+// after - before for the times and switches, maxrss is a peak and not a sum
+static void usage_since(const struct rusage *before, const struct rusage *after,
+                        struct rusage *usage) {
+  timersub(&after->ru_utime, &before->ru_utime, &usage->ru_utime);
+  timersub(&after->ru_stime, &before->ru_stime, &usage->ru_stime);
+  usage->ru_maxrss = after->ru_maxrss;
+  usage->ru_nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+  usage->ru_nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+// runs a command that has no pipes, builtins run in the shell itself
+static int run_single(Command *command, int read_fd, int output_fd, int *should_exit,
+                      struct rusage *usage) {
+  const Builtin *builtin = builtin_for(command);
+  if (builtin != NULL) {
+    //what it writes to our stdout is buffered until a line end or a fork
+    BuiltinIO io = {{read_fd, NULL}, {output_fd, NULL, 1}, should_exit};
+    struct rusage before, after;
+    if (timing) {
+      getrusage(RUSAGE_SELF, &before);
+    }
+    int result = run_builtin(builtin, command, &io);
+    if (timing) {
+      getrusage(RUSAGE_SELF, &after);
+      usage_since(&before, &after, usage);
+    }
+    return result;
+  }
+  //holy uncharted territory
+  return run_program(command->args, read_fd, output_fd, usage);
+}
+
+static void close_stage_in(Stage *stage) {
+  if (stage->own_in) {
+    if (stage->in.ring != NULL) {
+      ring_close_reader(stage->in.ring);
+    } else {
+      close(stage->in.fd);
+    }
+    stage->own_in = 0;
+  }
+}
+
+static void close_stage_out(Stage *stage) {
+  if (stage->own_out) {
+    if (stage->out.ring != NULL) {
+      ring_close_writer(stage->out.ring);
+    } else {
+      close(stage->out.fd);
+    }
+    stage->own_out = 0;
+  }
+}
+
+// a builtin stage on a thread of the shell. Closing its ends when it's done
+// is what tells the next stage there is no more input
+static void *run_thread_stage(void *arg) {
+  Stage *stage = arg;
+  //exit and die aren't BUILTIN_IN_PROCESS, nothing here can end the shell
+  int should_exit = 0;
+  BuiltinIO io = {stage->in, stage->out, &should_exit};
+  struct rusage before, after;
+  if (timing) {
+    getrusage(RUSAGE_THREAD, &before);
+  }
+  stage->status = run_builtin(stage->builtin, stage->command, &io);
+  if (timing) {
+    getrusage(RUSAGE_THREAD, &after);
+    usage_since(&before, &after, &stage->usage);
+  }
+  close_stage_in(stage);
+  close_stage_out(stage);
+  return NULL;
+}
+
+/*
+Starts every stage of the pipeline before waiting on any of them, so the
+stages run concurrently and a stage that writes more than a pipe buffer
+does not block forever. Each stage's status lands in pipestatus.
+
+Programs are spawned, builtins that touch shell state run in a forked
+child, and the BUILTIN_IN_PROCESS ones run on threads of the shell. Two
+threads next to each other talk through a ring, so a pipeline of builtins
+makes no fork and no pipe. A real pipe is only made where a process is on
+one side.
+*/
+static int run_pipeline(Command *commands_list, int num_commands, int read_fd, int output_fd) {
+  //resolve every program in the parent, where the cache lives
+  for (int i = 0; i < num_commands; i++) {
+    Stage *stage = &stages[i];
+    stage->command = &commands_list[i];
+    stage->builtin = builtin_for(stage->command);
+    stage->path = NULL;
+    stage->own_in = 0;
+    stage->own_out = 0;
+    stage->pid = -1;
+    stage->started = 0;
+    stage->status = EXIT_FAILURE;
+    memset(&stage->usage, 0, sizeof(stage->usage));
+    if (stage->builtin == NULL) {
+      stage->kind = STAGE_PROGRAM;
+      stage->path = findFunction(commands_list[i].args[0]);
+    } else if (stage->builtin->flags & BUILTIN_IN_PROCESS) {
+      stage->kind = STAGE_THREAD;
+    } else {
+      stage->kind = STAGE_FORK;
+    }
+  }
+
+  //connect every stage to the next before starting any
+  stages[0].in = (Stream){read_fd, NULL};
+  stages[0].own_in = read_fd != STDIN_FILENO;
+  stages[num_commands - 1].out = (Stream){output_fd, NULL};
+  for (int i = 0; i < num_commands - 1; i++) {
+    Stage *left = &stages[i];
+    Stage *right = &stages[i + 1];
+    if (left->kind == STAGE_THREAD && right->kind == STAGE_THREAD) {
+      Ring *ring = ring_create();
+      if (ring == NULL) {
+        perror("ring");
+        goto broken;
+      }
+      if (trace_enabled) {
+        ring_trace(ring, i);
+      }
+      //one ring, one reference per end
+      left->out = (Stream){-1, ring};
+      right->in = (Stream){-1, ring};
+    } else {
+      int pfd[2];
+      //close-on-exec, so spawned stages only see the ends they dup2
+      if (pipe2(pfd, O_CLOEXEC) != 0) {
+        perror("pipe");
+        goto broken;
+      }
+      left->out = (Stream){pfd[1], NULL};
+      right->in = (Stream){pfd[0], NULL};
+    }
+    left->own_out = 1;
+    right->own_in = 1;
+  }
+
+  //forks first, while no stage thread runs, then programs, then threads
+  output_flush();
+  for (int i = 0; i < num_commands; i++) {
+    Stage *stage = &stages[i];
+    if (stage->kind != STAGE_FORK) {
+      continue;
+    }
+    stage->pid = fork();
+    if (stage->pid == 0) {
+      //child
+      if (stage->in.fd != STDIN_FILENO) {
+        dup2(stage->in.fd, STDIN_FILENO);
+      }
+      if (stage->out.fd != STDOUT_FILENO) {
+        dup2(stage->out.fd, STDOUT_FILENO);
+      }
+      //every other end belongs to some other stage
+      for (int j = 0; j < num_commands; j++) {
+        if (stages[j].own_in && stages[j].in.ring == NULL && j != i) {
+          close(stages[j].in.fd);
+        }
+        if (stages[j].own_out && stages[j].out.ring == NULL) {
+          close(stages[j].out.fd);
+        }
+      }
+      if (output_fd != STDOUT_FILENO) {
+        close(output_fd);
+      }
+      run_stage(stage->builtin, stage->command, stage->in.fd);
+    }
+    if (stage->pid < 0) {
+      perror("fork");
+    } else {
+      TRACE("fork", "\"child\":%d,\"stage\":%d", (int)stage->pid, i);
+    }
+    close_stage_in(stage);
+    close_stage_out(stage);
+  }
+
+  for (int i = 0; i < num_commands; i++) {
+    Stage *stage = &stages[i];
+    if (stage->kind != STAGE_PROGRAM) {
+      continue;
+    }
+    if (stage->path == NULL) {
+      fprintf(stderr, "command not found\n");
+    } else {
+      stage->pid = spawn_command(stage->path, stage->command->args, stage->in.fd, stage->out.fd);
+      if (stage->pid < 0) {
+        perror(stage->command->args[0]);
+      }
+    }
+    close_stage_in(stage);
+    close_stage_out(stage);
+  }
+
+  //threads get every signal blocked, so SIGCHLD stays with the shell and a
+  //write to a pipe with no reader fails with EPIPE instead of killing it
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (int i = 0; i < num_commands; i++) {
+    Stage *stage = &stages[i];
+    if (stage->kind != STAGE_THREAD) {
+      continue;
+    }
+    int err = pthread_create(&stage->thread, NULL, run_thread_stage, stage);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      close_stage_in(stage);
+      close_stage_out(stage);
+      continue;
+    }
+    stage->started = 1;
+    TRACE("thread_start", "\"stage\":%d", i);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  //stages that never started keep the failure status from reset_pipestatus
+  for (int i = 0; i < num_commands; i++) {
+    Stage *stage = &stages[i];
+    if (stage->started) {
+      pthread_join(stage->thread, NULL);
+      TRACE("thread_exit", "\"stage\":%d,\"status\":%d", i, stage->status);
+      pipestatus[i] = stage->status;
+      continue;
+    }
+    if (stage->pid < 0) {
+      continue;
+    }
+    int status;
+    while (wait4(stage->pid, &status, 0, &stage->usage) < 0) {
+      if (errno != EINTR) {
+        status = -1;
+        break;
+      }
+    }
+    if (status != -1 && trace_enabled) {
+      trace_exit(stage->pid, i, status);
+    }
+    pipestatus[i] = status == -1 ? EXIT_FAILURE : decode_status(status);
+  }
+
+  int last_status = pipestatus[num_commands - 1];
+  if (pipefail) {
+    for (int i = pipestatus_len - 1; i >= 0; i--) {
+      if (pipestatus[i] != EXIT_SUCCESS) {
+        return pipestatus[i];
+      }
+    }
+  }
+  return last_status;
+
+broken:
+  //nothing was started, drop the ends made so far
+  for (int i = 0; i < num_commands; i++) {
+    close_stage_in(&stages[i]);
+    close_stage_out(&stages[i]);
+  }
+  return EXIT_FAILURE;
+}
+
+static double seconds(const struct timeval *tv) {
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void print_usage(const struct rusage *usage) {
+  fprintf(stderr, "user %.3fs sys %.3fs maxrss %ldkb ctxsw %ld vol %ld invol",
+          seconds(&usage->ru_utime), seconds(&usage->ru_stime),
+          usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+}
+
 /*
-If the command is not a builtin function, the function will return 0, otherwise, it will return the following:
-1 - cd
-2 - pwd
-3 - which
-4 - exit
-5 - die
+What time prints to stderr once the line is done: wall time, then user and
+system time, the largest max RSS and the context switches summed over
+every stage. time -v adds a line per stage saying how it ran. Programs and
+forked builtins are measured by wait4(), threads with RUSAGE_THREAD and a
+builtin run by the shell itself with RUSAGE_SELF.
 */
-int whichFunction(char *command) {
-  if (strcmp(command, "cd") == 0) {
-    return 1;
-  } else if (strcmp(command, "pwd") == 0) {
-    return 2;
-  } else if (strcmp(command, "which") == 0) {
-    return 3;
-  } else if (strcmp(command, "exit") == 0) {
-    return 4;
-  } else if (strcmp(command, "die") == 0) {
-    return 5;
+static void report_time(ParsedCmd *parsed_command, const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double real = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+
+  int num_commands = parsed_command->num_commands;
+  struct rusage total;
+  memset(&total, 0, sizeof(total));
+  for (int i = 0; i < num_commands; i++) {
+    const struct rusage *usage = &stages[i].usage;
+    timeradd(&total.ru_utime, &usage->ru_utime, &total.ru_utime);
+    timeradd(&total.ru_stime, &usage->ru_stime, &total.ru_stime);
+    if (usage->ru_maxrss > total.ru_maxrss) {
+      total.ru_maxrss = usage->ru_maxrss;
+    }
+    total.ru_nvcsw += usage->ru_nvcsw;
+    total.ru_nivcsw += usage->ru_nivcsw;
+  }
+
+  output_flush();
+  fprintf(stderr, "time: real %.3fs ", real);
+  print_usage(&total);
+  fprintf(stderr, "\n");
+  if (parsed_command->is_timed < 2) {
+    return;
+  }
+  static const char *how[] = {"program", "forked", "thread", "shell"};
+  for (int i = 0; i < num_commands; i++) {
+    fprintf(stderr, "time: [%d] %s (%s) ", i, parsed_command->commands[i].args[0],
+            how[stages[i].kind]);
+    print_usage(&stages[i].usage);
+    fprintf(stderr, "\n");
+  }
+}
+
+// runs the line without & and times it if it starts with time. Owns read_fd
+static int run_foreground(ParsedCmd *parsed_command, int read_fd, int output_fd, int *should_exit) {
+  Command *commands_list = parsed_command->commands;
+  int num_commands = parsed_command->num_commands;
+  struct timespec start;
+  timing = parsed_command->is_timed;
+  if (timing) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  }
+
+  int result;
+  if (num_commands == 1) {
+    //one function
+    Stage *stage = &stages[0];
+    stage->command = &commands_list[0];
+    stage->kind = builtin_for(stage->command) != NULL ? STAGE_SHELL : STAGE_PROGRAM;
+    memset(&stage->usage, 0, sizeof(stage->usage));
+    result = run_single(&commands_list[0], read_fd, output_fd, should_exit, &stage->usage);
+    pipestatus[0] = result;
+    if (read_fd != STDIN_FILENO) {
+      close(read_fd);
+    }
+  } else {
+    //more than one command, run_pipeline owns read_fd from here
+    result = run_pipeline(commands_list, num_commands, read_fd, output_fd);
+  }
+
+  if (timing) {
+    report_time(parsed_command, &start);
+    timing = 0;
+  }
+  return result;
+}
+
+/*
+Starts the line as a background job and returns without waiting. A lone
+external command is spawned directly, anything else runs in a forked copy
+of the shell. Without a < the job reads from /dev/null, so it can't take
+input meant for the shell. Owns read_fd.
+*/
+static int run_background(ParsedCmd *parsed_command, int read_fd, int output_fd, int is_interactive) {
+  if (read_fd == STDIN_FILENO) {
+    read_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (read_fd < 0) {
+      perror("/dev/null");
+      return EXIT_FAILURE;
+    }
+  }
+
+  Command *commands_list = parsed_command->commands;
+  int num_commands = parsed_command->num_commands;
+  pid_t pid;
+  //a timed job runs in a subshell, which reports when it is done
+  if (num_commands == 1 && !parsed_command->is_timed &&
+      builtin_for(&commands_list[0]) == NULL) {
+    const char *path = findFunction(commands_list[0].args[0]);
+    if (path == NULL) {
+      fprintf(stderr, "command not found\n");
+      close(read_fd);
+      return EXIT_FAILURE;
+    }
+    output_flush();
+    pid = spawn_command(path, commands_list[0].args, read_fd, output_fd);
+    if (pid < 0) {
+      perror(commands_list[0].args[0]);
+    }
+    close(read_fd);
   } else {
+    output_flush();
+    pid = fork();
+    if (pid == 0) {
+      //child, runs the line in the foreground of its own copy of the shell
+      int should_exit = 0;
+      if (reset_pipestatus(num_commands) != 0) {
+        _exit(EXIT_FAILURE);
+      }
+      int result = run_foreground(parsed_command, read_fd, output_fd, &should_exit);
+      output_flush();
+      fflush(stderr);
+      trace_flush();
+      _exit(result);
+    }
+    if (pid < 0) {
+      perror("fork");
+    } else {
+      TRACE("fork", "\"child\":%d,\"background\":1", (int)pid);
+    }
+    close(read_fd);
+  }
+  if (pid < 0) {
+    return EXIT_FAILURE;
+  }
+
+  int id = jobs_add(pid);
+  if (id < 0) {
+    perror("jobs");
+  } else if (is_interactive) {
+    printf("[%d] %d\n", id, (int)pid);
+  }
+  return EXIT_SUCCESS;
+}
+
+/*
+Gives the body of a << or <<< to the line as its stdin, without a temp
+file. A body that fits in a pipe is written into one before anything runs,
+so the write can't wait on a reader. A bigger one goes into a sealed
+memfd, which the line reads like a regular file. Returns the fd or -1.
+*/
+static int here_doc_fd(const char *text, size_t len) {
+  int pfd[2];
+  if (pipe2(pfd, O_CLOEXEC) == 0) {
+    Stream in = {pfd[1], NULL};
+    if ((len <= PIPE_BUF || fcntl(pfd[1], F_GETPIPE_SZ) >= (long)len) &&
+        (len == 0 || stream_write(&in, text, len) == (ssize_t)len)) {
+      close(pfd[1]);
+      TRACE("here_doc", "\"bytes\":%zu,\"memfd\":0", len);
+      return pfd[0];
+    }
+    close(pfd[0]);
+    close(pfd[1]);
+  }
+
+  int fd = memfd_create("mysh-here-doc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    return -1;
+  }
+  Stream body = {fd, NULL};
+  if (stream_write(&body, text, len) != (ssize_t)len ||
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0 ||
+      lseek(fd, 0, SEEK_SET) != 0) {
+    close(fd);
+    return -1;
+  }
+  TRACE("here_doc", "\"bytes\":%zu,\"memfd\":1", len);
+  return fd;
+}
+
+// a line of nothing but NAME=value words sets shell variables. With a
+// redirect or & it is run like any other command.
+static int is_assignment_line(const ParsedCmd *parsed_command) {
+  if (parsed_command->num_commands != 1 || parsed_command->input_file != NULL ||
+      parsed_command->input_text != NULL || parsed_command->output_file != NULL ||
+      parsed_command->is_background) {
     return 0;
   }
+  const Command *command = &parsed_command->commands[0];
+  for (int i = 0; i < command->num_args; i++) {
+    if (!vars_is_assignment(command->args[i])) {
+      return 0;
+    }
+  }
+  return command->num_args > 0;
+}
+
+// sets the variables of an assignment line. It counts as one stage run by
+// the shell, for pipestatus and time.
+static int run_assignment(ParsedCmd *parsed_command, int prevState) {
+  if (reset_pipestatus(1) != 0) {
+    perror("malloc failed");
+    return EXIT_FAILURE;
+  }
+  Stage *stage = &stages[0];
+  stage->command = &parsed_command->commands[0];
+  stage->kind = STAGE_SHELL;
+  memset(&stage->usage, 0, sizeof(stage->usage));
+  struct timespec start;
+  struct rusage before, after;
+  if (parsed_command->is_timed) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &before);
+  }
+
+  int result = vars_assign(stage->command->args, stage->command->num_args, prevState) == 0
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+  pipestatus[0] = result;
+
+  if (parsed_command->is_timed) {
+    getrusage(RUSAGE_SELF, &after);
+    usage_since(&before, &after, &stage->usage);
+    report_time(parsed_command, &start);
+  }
+  return result;
 }
 
 /* 
@@ -114,6 +1163,9 @@ int execute(ParsedCmd *parsed_command, int prevState, int is_interactive, int *s
     return prevState;
   }
 
+  //stat() results test remembered belong to the last line
+  builtin_test_forget();
+
   if (prevState == EXIT_SUCCESS && parsed_command->is_or == 1) {
     return prevState;
   }
@@ -122,19 +1174,35 @@ int execute(ParsedCmd *parsed_command, int prevState, int is_interactive, int *s
   }
 
   int num_commands = parsed_command->num_commands;
+  if (num_commands == 0) {
+    return prevState;
+  }
+
+  if (is_assignment_line(parsed_command)) {
+    return run_assignment(parsed_command, prevState);
+  }
+  if (vars_expand(parsed_command, prevState) != 0) {
+    return EXIT_FAILURE;
+  }
+
   int read_fd = STDIN_FILENO;
   if (parsed_command->input_file != NULL) {
-    read_fd = open(parsed_command->input_file, O_RDONLY);
+    read_fd = open(parsed_command->input_file, O_RDONLY | O_CLOEXEC);
     if (read_fd < 0) {
       perror("input file");
       return EXIT_FAILURE;
     }
+  } else if (parsed_command->input_text != NULL) {
+    read_fd = here_doc_fd(parsed_command->input_text, parsed_command->input_text_len);
+    if (read_fd < 0) {
+      perror("here-doc");
+      return EXIT_FAILURE;
+    }
   }
 
-  Command *commands_list = parsed_command->commands;
   int output_fd = STDOUT_FILENO;
   if (parsed_command->output_file != NULL) {
-    output_fd = open(parsed_command->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    output_fd = open(parsed_command->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
     if (output_fd < 0) {
       perror("can't open output file");
       if (read_fd != STDIN_FILENO) close(read_fd);
@@ -142,222 +1210,26 @@ int execute(ParsedCmd *parsed_command, int prevState, int is_interactive, int *s
     }
   }
 
-  //one function
-  if (num_commands == 1) {
-    switch (whichFunction(commands_list[0].args[0]))
-    {
-    case 1:
-      //cd accepts one argument
-      if (commands_list[0].num_args != 2) {
-        printf("too many args in cd\n");
-        return EXIT_FAILURE;
-      }
-      if (cd(commands_list[0].args[1]) != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
-      }
-      return EXIT_SUCCESS;
-      break;
-    
-    case 2:
-    //pwd accepts no arguments
-      if (commands_list[0].num_args != 1) {
-        printf("too many args in pwd\n");
-        return EXIT_FAILURE;
-      }
-      if (pwd(output_fd) != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
-      }
-      return EXIT_SUCCESS;
-      break;
-    
-    case 3:
-    //which accepts one argument
-      if (commands_list[0].num_args != 2) {
-        printf("which only takes one argument\n");
-        return EXIT_FAILURE;
-      }
-      if (which(commands_list[0].args[1]) != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
-      }
-      return EXIT_SUCCESS;
-      break;
-
-    case 4:
-      //exit doesn't care, exit is god, it succeeds :)
-      if (commands_list[0].num_args != 1) {
-        printf("exit takes no arguments\n");
-        return EXIT_FAILURE;
-      }
-      *should_exit = 1;
-      return EXIT_SUCCESS;
-      break;
-    
-    case 5:
-      //die will print all argument and fail, it is not god :(
-      *should_exit = 1;
-      for (int j = 1; j < commands_list[0].num_args; j++) {
-        if (j > 1) printf(" ");
-        printf("%s", commands_list[0].args[j]);
-      }
-      if (commands_list[0].num_args > 1) printf("\n");
-      return EXIT_FAILURE;
-      break;
-    
-    case 0:
-      //holy uncharted territory
-      pid_t pid = fork();
-      if (pid == 0) {
-        //child
-        if (read_fd != STDIN_FILENO) {
-          dup2(read_fd, STDIN_FILENO);
-          close(read_fd);
-        }
-        if (output_fd != STDOUT_FILENO) {
-          dup2(output_fd, STDOUT_FILENO);
-          close(output_fd);
-        }
-        char *path = findFunction(commands_list[0].args[0]);
-        if (path == NULL) {
-          printf("command not found\n");
-          exit(EXIT_FAILURE);
-        }
-        execv(path, commands_list[0].args);
-        return EXIT_FAILURE;
-      } else  {
-        //parent
-        int status;
-        wait(&status);
-        if (WIFEXITED(status)) {
-          return WEXITSTATUS(status);
-        } else if (WIFSIGNALED(status)) {
-          return EXIT_FAILURE;
-        } else {
-          return EXIT_FAILURE;
-        }
-      }
-    default:
-      break;
+  if (parsed_command->is_background) {
+    //pipestatus keeps describing the last foreground command
+    int result = run_background(parsed_command, read_fd, output_fd, is_interactive);
+    if (output_fd != STDOUT_FILENO) {
+      close(output_fd);
     }
+    return result;
   }
 
-  //more than one command
-  pid_t pid;
-  int pfd[2];
-  int last_status = 0;
-  for (int i = 0; i < num_commands; i++) {
-    if (i < num_commands - 1) {
-      if (pipe(pfd) != 0) {
-        perror("pipe");
-        if (read_fd != STDIN_FILENO) close(read_fd);
-        return EXIT_FAILURE;
-      }
-    }
-
-    pid = fork();
-    if (pid < 0) {
-      perror("fork");
-      return EXIT_FAILURE;
-    }
-
-    if (pid == 0) {
-      //child
-      if (read_fd != STDIN_FILENO) {
-        dup2(read_fd, STDIN_FILENO);
-        close(read_fd);
-      }
-
-      if (i < num_commands - 1) {
-        dup2(pfd[1], STDOUT_FILENO);
-        close(pfd[0]);
-        close(pfd[1]);
-      } else {
-        if (parsed_command->output_file != NULL) {
-          int write_fd = open(parsed_command->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0640);
-          if (write_fd < 0) {
-            perror("output file");
-            exit(EXIT_FAILURE);
-          }
-          dup2(write_fd, STDOUT_FILENO);
-          close(write_fd);
-        }
-      }
+  if (reset_pipestatus(num_commands) != 0) {
+    perror("malloc failed");
+    if (read_fd != STDIN_FILENO) close(read_fd);
+    if (output_fd != STDOUT_FILENO) close(output_fd);
+    return EXIT_FAILURE;
+  }
 
+  int result = run_foreground(parsed_command, read_fd, output_fd, should_exit);
 
-      switch (whichFunction(commands_list[i].args[0])) {
-        case 0:
-            char *path = findFunction(commands_list[i].args[0]);
-            if (path == NULL) {
-              printf("command not found\n");
-              exit(EXIT_FAILURE);
-            }
-            execv(path, commands_list[i].args);
-            perror("execv");
-            free(path);
-            exit(EXIT_FAILURE);
-        case 1:
-          if (commands_list[i].num_args != 2) {
-            printf("cd got too many arguments\n");
-            exit(EXIT_FAILURE);
-          }
-          if (cd(commands_list[i].args[1]) != EXIT_SUCCESS) {
-            exit(EXIT_FAILURE);
-          }
-          exit(EXIT_SUCCESS);
-        case 2:
-          if (commands_list[i].num_args != 1) { 
-            exit(EXIT_FAILURE); 
-          }
-          if (pwd(STDOUT_FILENO) != EXIT_SUCCESS)  {
-            exit(EXIT_FAILURE);
-          }
-          exit(EXIT_SUCCESS);
-        case 3:
-          if (commands_list[i].num_args != 2) {
-            exit(EXIT_FAILURE);
-          }
-          {
-            char *path = findFunction(commands_list[i].args[1]);
-            if (path == NULL) {
-              printf("command not found\n");
-              exit(EXIT_FAILURE);
-            }
-            printf("%s\n", path);
-            free(path);
-            exit(EXIT_SUCCESS);
-          }
-        case 4:
-          exit(EXIT_SUCCESS);
-        case 5:
-          for (int j = 1; j < commands_list[i].num_args; j++) {
-            if (j > 1) printf(" ");
-            printf("%s", commands_list[i].args[j]);
-          }
-          if (commands_list[i].num_args > 1) printf("\n");
-          exit(EXIT_FAILURE);
-        default:
-          exit(EXIT_FAILURE);
-        }
-    } else {
-      //parent
-      if (read_fd != STDIN_FILENO) {
-        close(read_fd);
-      }
-      if (i < num_commands - 1) {
-        close(pfd[1]);
-        read_fd = pfd[0];
-      }
-      int status;
-      waitpid(pid, &status, 0);
-      if (WIFEXITED(status)) {
-        last_status = WEXITSTATUS(status);
-      } else {
-        last_status = EXIT_FAILURE;
-      }
-    }
-  }
   if (output_fd != STDOUT_FILENO) {
     close(output_fd);
   }
-  return last_status;
+  return result;
 }
-
@@ -1 +1,46 @@
-int execute(ParsedCmd *, int, int, int*);
\ No newline at end of file
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "parser.h"
+#include "ring.h"
+
+int execute(ParsedCmd *, int, int, int*);
+
+// full path of an external command, owned by the path cache
+const char *findFunction(char *function);
+
+// where a builtin reads and writes. exit and die set *should_exit
+typedef struct {
+  Stream in;
+  Stream out;
+  int *should_exit;
+} BuiltinIO;
+
+// flags of a Builtin
+#define BUILTIN_STANDIN 1    // stands in for a /bin program, which still shows it
+#define BUILTIN_IN_PROCESS 2 // touches no shell state and no unlocked static
+                             // data, so a pipeline can run it on a thread
+
+typedef struct {
+  const char *name;
+  int min_args;      // counting the name
+  int max_args;      // -1 for no limit
+  const char *usage; // printed when the count is off, or NULL
+  int (*run)(int num_args, char **args, BuiltinIO *io);
+  int flags;
+  // NULL if it takes any args, otherwise whether it does these or the
+  // program it stands in for has to run instead
+  int (*takes)(int num_args, char **args);
+} Builtin;
+
+// the builtin called name, or NULL for anything else
+const Builtin *find_builtin(const char *name);
+
+// per-stage statuses of the last command run by execute()
+const int *get_pipestatus(int *count);
+
+// when enabled, a pipeline returns the last non-zero stage status
+void set_pipefail(int enabled);
+int get_pipefail(void);
+
+#endif
@@ -0,0 +1,84 @@
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PRIME_A 0x9E3779B185EBCA87ULL
+#define PRIME_B 0xC2B2AE3D27D4EB4FULL
+
+static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// splitmix64 finalizer, spreads every input bit over the output
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static void add_word(Hasher *hasher, uint64_t word) {
+  hasher->a = rotl(hasher->a ^ word, 31) * PRIME_A;
+  hasher->b = rotl(hasher->b + word, 27) * PRIME_B;
+}
+
+void hasher_init(Hasher *hasher) {
+  hasher->a = PRIME_B;
+  hasher->b = PRIME_A;
+  hasher->length = 0;
+  hasher->tail_len = 0;
+}
+
+void hasher_update(Hasher *hasher, const void *data, size_t len) {
+  const unsigned char *p = data;
+  hasher->length += len;
+
+  // finish a word started by an earlier call
+  while (hasher->tail_len > 0 && len > 0) {
+    hasher->tail[hasher->tail_len++] = *p++;
+    len--;
+    if (hasher->tail_len == 8) {
+      uint64_t word;
+      memcpy(&word, hasher->tail, 8);
+      add_word(hasher, word);
+      hasher->tail_len = 0;
+    }
+  }
+
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    add_word(hasher, word);
+    p += 8;
+    len -= 8;
+  }
+
+  // a word left unfinished above is kept, len is 0 then
+  if (len > 0) {
+    memcpy(hasher->tail, p, len);
+    hasher->tail_len = len;
+  }
+}
+
+void hasher_final(Hasher *hasher, uint64_t out[2]) {
+  uint64_t word = 0;
+  memcpy(&word, hasher->tail, hasher->tail_len);
+  add_word(hasher, word ^ ((uint64_t)hasher->tail_len << 56));
+
+  uint64_t a = mix(hasher->a ^ hasher->length);
+  uint64_t b = mix(hasher->b + a);
+  out[0] = a ^ b;
+  out[1] = b;
+}
+
+void hash_bytes(const void *data, size_t len, uint64_t out[2]) {
+  Hasher hasher;
+  hasher_init(&hasher);
+  hasher_update(&hasher, data, len);
+  hasher_final(&hasher, out);
+}
+
+void hash_to_hex(const uint64_t hash[2], char out[33]) {
+  snprintf(out, 33, "%016llx%016llx", (unsigned long long)hash[0],
+           (unsigned long long)hash[1]);
+}
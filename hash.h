@@ -0,0 +1,28 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// fast 128 bit content hash for cache keys and checksums. It works on 8
+// bytes at a time, so hashing a large file costs far less than reading it,
+// but it is not cryptographic.
+typedef struct {
+  uint64_t a;
+  uint64_t b;
+  uint64_t length;
+  unsigned char tail[8];
+  int tail_len;
+} Hasher;
+
+void hasher_init(Hasher *hasher);
+void hasher_update(Hasher *hasher, const void *data, size_t len);
+void hasher_final(Hasher *hasher, uint64_t out[2]);
+
+// hash of one buffer
+void hash_bytes(const void *data, size_t len, uint64_t out[2]);
+
+// 32 lowercase hex digits and a '\0'
+void hash_to_hex(const uint64_t hash[2], char out[33]);
+
+#endif
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include "jobs.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+typedef struct {
+  int id;
+  pid_t pid;
+  volatile sig_atomic_t done;
+  volatile int status; // wait status, valid once done is set
+} Job;
+
+// only changed with SIGCHLD blocked, so the handler always sees a
+// consistent table
+static Job *jobs = NULL;
+static int num_jobs = 0;
+static int jobs_cap = 0;
+static int handler_installed = 0;
+// how many jobs in the table are done
+static volatile sig_atomic_t num_done = 0;
+
+// the wait status we give a job whose child went missing, exit code 127
+#define LOST_STATUS (127 << 8)
+
+// reaps the jobs that have finished, without blocking. Safe to call from
+// the signal handler.
+static void reap(void) {
+  for (int i = 0; i < num_jobs; i++) {
+    if (jobs[i].done) {
+      continue;
+    }
+    int status;
+    pid_t pid = waitpid(jobs[i].pid, &status, WNOHANG);
+    if (pid == jobs[i].pid) {
+      jobs[i].status = status;
+      jobs[i].done = 1;
+      num_done++;
+    } else if (pid < 0 && errno == ECHILD) {
+      // not our child, for example in a forked pipeline stage
+      jobs[i].status = LOST_STATUS;
+      jobs[i].done = 1;
+      num_done++;
+    }
+  }
+}
+
+static void on_sigchld(int sig) {
+  (void)sig;
+  int saved_errno = errno;
+  reap();
+  errno = saved_errno;
+}
+
+static void block_sigchld(sigset_t *old) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, old);
+}
+
+static void restore_mask(const sigset_t *old) {
+  sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+static void install_handler(void) {
+  struct sigaction action;
+  action.sa_handler = on_sigchld;
+  sigemptyset(&action.sa_mask);
+  // restart reads and writes the handler interrupts
+  action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  if (sigaction(SIGCHLD, &action, NULL) == 0) {
+    handler_installed = 1;
+  }
+}
+
+static void remove_job(int i) {
+  if (jobs[i].done) {
+    num_done--;
+  }
+  for (int j = i + 1; j < num_jobs; j++) {
+    jobs[j - 1] = jobs[j];
+  }
+  num_jobs--;
+}
+
+// forgets the oldest finished jobs once there are too many, down to half
+// the limit so this pass over the table is rare. SIGCHLD is blocked.
+static void forget_old_jobs(void) {
+  if (num_done <= MAX_DONE_JOBS) {
+    return;
+  }
+  int forget = num_done - MAX_DONE_JOBS / 2;
+  int kept = 0;
+  for (int i = 0; i < num_jobs; i++) {
+    if (forget > 0 && jobs[i].done) {
+      forget--;
+      num_done--;
+      continue;
+    }
+    jobs[kept++] = jobs[i];
+  }
+  num_jobs = kept;
+}
+
+int jobs_add(pid_t pid) {
+  if (!handler_installed) {
+    install_handler();
+  }
+
+  sigset_t old;
+  block_sigchld(&old);
+  forget_old_jobs();
+  if (num_jobs == jobs_cap) {
+    int cap = jobs_cap > 0 ? jobs_cap * 2 : 8;
+    Job *grown = realloc(jobs, cap * sizeof(Job));
+    if (grown == NULL) {
+      restore_mask(&old);
+      return -1;
+    }
+    jobs = grown;
+    jobs_cap = cap;
+  }
+
+  // numbered like bash, one past the highest number in use
+  int id = num_jobs > 0 ? jobs[num_jobs - 1].id + 1 : 1;
+  Job *job = &jobs[num_jobs++];
+  job->id = id;
+  job->pid = pid;
+  job->done = 0;
+  job->status = 0;
+
+  // it may have exited before it was in the table for the handler to see
+  reap();
+  restore_mask(&old);
+  return id;
+}
+
+int jobs_count(void) { return num_jobs; }
+
+// finds a job, -1 if there is none
+static int find(int id, int by_pid) {
+  for (int i = 0; i < num_jobs; i++) {
+    if (by_pid ? jobs[i].pid == id : jobs[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// sleeps until a SIGCHLD, the caller has it blocked in the current mask
+static void sleep_for_child(const sigset_t *old) {
+  reap();
+  sigset_t wait_mask = *old;
+  sigdelset(&wait_mask, SIGCHLD);
+  sigsuspend(&wait_mask);
+}
+
+int jobs_wait_one(int id, int by_pid, int *status) {
+  sigset_t old;
+  block_sigchld(&old);
+  int i;
+  while ((i = find(id, by_pid)) >= 0 && !jobs[i].done) {
+    sleep_for_child(&old);
+  }
+  if (i >= 0) {
+    *status = jobs[i].status;
+    remove_job(i);
+  }
+  restore_mask(&old);
+  return i >= 0 ? 0 : -1;
+}
+
+int jobs_wait_next(int *id, int *status) {
+  sigset_t old;
+  block_sigchld(&old);
+  int found = -1;
+  while (num_jobs > 0) {
+    for (int i = 0; i < num_jobs && found < 0; i++) {
+      if (jobs[i].done) {
+        found = i;
+      }
+    }
+    if (found >= 0) {
+      break;
+    }
+    sleep_for_child(&old);
+  }
+  if (found >= 0) {
+    *id = jobs[found].id;
+    *status = jobs[found].status;
+    remove_job(found);
+  }
+  restore_mask(&old);
+  return found >= 0 ? 0 : -1;
+}
+
+void jobs_wait_all(void) {
+  int id, status;
+  while (jobs_wait_next(&id, &status) == 0) {
+  }
+}
+
+void jobs_notify(void) {
+  sigset_t old;
+  block_sigchld(&old);
+  for (int i = 0; i < num_jobs;) {
+    if (!jobs[i].done) {
+      i++;
+      continue;
+    }
+    int status = jobs[i].status;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      printf("[%d] Done\n", jobs[i].id);
+    } else if (WIFEXITED(status)) {
+      printf("[%d] Exit %d\n", jobs[i].id, WEXITSTATUS(status));
+    } else {
+      printf("[%d] Killed by signal %d\n", jobs[i].id, WTERMSIG(status));
+    }
+    remove_job(i);
+  }
+  restore_mask(&old);
+}
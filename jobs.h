@@ -0,0 +1,34 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+
+// Background jobs started with a trailing &. A SIGCHLD handler reaps them
+// as they finish, waiting only on job pids so foreground waits never lose
+// a child to it. A finished job stays in the table until it is waited for,
+// but only the last MAX_DONE_JOBS finished ones are kept, so a script that
+// starts jobs it never waits on doesn't grow the table without bound.
+
+#define MAX_DONE_JOBS 1024
+
+// adds a started job, returns its job number or -1
+int jobs_add(pid_t pid);
+
+// number of jobs in the table, finished or not
+int jobs_count(void);
+
+// waits for the job with this job number (by_pid 0) or pid (by_pid 1).
+// Returns 0 and the wait status, or -1 if there is no such job.
+int jobs_wait_one(int id, int by_pid, int *status);
+
+// waits for the next job to finish, or takes one that already has. Returns
+// 0 with its number and wait status, or -1 if there are no jobs.
+int jobs_wait_next(int *id, int *status);
+
+// waits for every job and empties the table
+void jobs_wait_all(void);
+
+// prints and forgets the jobs that have finished, for the prompt
+void jobs_notify(void);
+
+#endif
@@ -0,0 +1,193 @@
+#define _DEFAULT_SOURCE
+#include "line_reader.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void line_reader_init(LineReader *reader, int fd, size_t read_size,
+                      size_t max_line) {
+  reader->fd = fd;
+  reader->buffer = NULL;
+  reader->capacity = 0;
+  reader->start = 0;
+  reader->end = 0;
+  reader->scanned = 0;
+  reader->read_size = read_size > 0 ? read_size : 4096;
+  reader->max_line = max_line;
+  reader->eof = 0;
+  reader->discarding = 0;
+  reader->line_number = 0;
+  reader->map = NULL;
+  reader->map_size = 0;
+}
+
+int line_reader_map(LineReader *reader) {
+  struct stat st;
+  if (fstat(reader->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  // we go through it once front to back, so read ahead aggressively
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  reader->map = map;
+  reader->map_size = st.st_size;
+  return 0;
+}
+
+// line_reader_next() for a mapped file, lines are slices of the mapping
+static int next_mapped(LineReader *reader, const char **line, size_t *length) {
+  while (reader->start < reader->map_size) {
+    const char *line_start = reader->map + reader->start;
+    size_t left = reader->map_size - reader->start;
+    const char *newline = memchr(line_start, '\n', left);
+    size_t line_len = newline != NULL ? (size_t)(newline - line_start) : left;
+
+    reader->start += line_len + (newline != NULL ? 1 : 0);
+    reader->line_number++;
+    if (line_len > reader->max_line) {
+      return LINE_TOO_LONG;
+    }
+    *line = line_start;
+    *length = line_len;
+    return LINE_OK;
+  }
+  return LINE_EOF;
+}
+
+// makes room for read_size more bytes plus the '\0' a last line may need.
+// The unread bytes only move when the free space at the end runs out, so
+// each byte is moved at most once per buffer fill, not once per line.
+static int make_room(LineReader *reader) {
+  size_t needed = reader->read_size + 1;
+  if (reader->capacity - reader->end >= needed) {
+    return 0;
+  }
+
+  size_t pending = reader->end - reader->start;
+  if (reader->start > 0 && reader->capacity - pending >= needed) {
+    memmove(reader->buffer, reader->buffer + reader->start, pending);
+    reader->start = 0;
+    reader->end = pending;
+    return 0;
+  }
+
+  size_t capacity = reader->capacity > 0 ? reader->capacity : needed;
+  while (capacity - pending < needed) {
+    capacity *= 2;
+  }
+  char *buffer = malloc(capacity);
+  if (buffer == NULL) {
+    return -1;
+  }
+  if (pending > 0) {
+    memcpy(buffer, reader->buffer + reader->start, pending);
+  }
+  free(reader->buffer);
+  reader->buffer = buffer;
+  reader->capacity = capacity;
+  reader->start = 0;
+  reader->end = pending;
+  return 0;
+}
+
+// reads once, returns the number of bytes, 0 at EOF or -1 on error
+static ssize_t fill(LineReader *reader) {
+  if (make_room(reader) != 0) {
+    return -1;
+  }
+  ssize_t bytes_read;
+  do {
+    bytes_read = read(reader->fd, reader->buffer + reader->end,
+                      reader->read_size);
+  } while (bytes_read < 0 && errno == EINTR);
+
+  if (bytes_read > 0) {
+    reader->end += bytes_read;
+  } else if (bytes_read == 0) {
+    reader->eof = 1;
+  }
+  return bytes_read;
+}
+
+int line_reader_next(LineReader *reader, const char **line, size_t *length) {
+  if (reader->map != NULL) {
+    return next_mapped(reader, line, length);
+  }
+
+  while (1) {
+    size_t unscanned = reader->end - reader->start - reader->scanned;
+    char *newline = NULL;
+    if (unscanned > 0) {
+      newline = memchr(reader->buffer + reader->start + reader->scanned, '\n',
+                       unscanned);
+    }
+
+    if (newline != NULL) {
+      size_t line_len = newline - (reader->buffer + reader->start);
+      char *line_start = reader->buffer + reader->start;
+      reader->start += line_len + 1;
+      reader->scanned = 0;
+
+      if (reader->discarding) {
+        // the tail of a line that was already reported as too long
+        reader->discarding = 0;
+        continue;
+      }
+      reader->line_number++;
+      if (line_len > reader->max_line) {
+        return LINE_TOO_LONG;
+      }
+      *newline = '\0';
+      *line = line_start;
+      *length = line_len;
+      return LINE_OK;
+    }
+    reader->scanned += unscanned;
+
+    if (reader->scanned > reader->max_line) {
+      // drop what we have of the line and skip to its end
+      reader->start = reader->end;
+      reader->scanned = 0;
+      if (!reader->discarding) {
+        reader->discarding = 1;
+        reader->line_number++;
+        return LINE_TOO_LONG;
+      }
+    }
+
+    if (reader->eof) {
+      size_t line_len = reader->end - reader->start;
+      if (line_len == 0 || reader->discarding) {
+        return LINE_EOF;
+      }
+      // last line with no '\n', make_room() always left space for the '\0'
+      reader->buffer[reader->end] = '\0';
+      *line = reader->buffer + reader->start;
+      *length = line_len;
+      reader->start = reader->end;
+      reader->scanned = 0;
+      reader->line_number++;
+      return LINE_OK;
+    }
+
+    if (fill(reader) < 0) {
+      return LINE_ERROR;
+    }
+  }
+}
+
+void line_reader_free(LineReader *reader) {
+  if (reader->map != NULL) {
+    munmap((void *)reader->map, reader->map_size);
+    reader->map = NULL;
+  }
+  free(reader->buffer);
+  reader->buffer = NULL;
+  reader->capacity = 0;
+}
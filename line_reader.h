@@ -0,0 +1,46 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stddef.h>
+
+#define LINE_OK 1
+#define LINE_EOF 0
+#define LINE_ERROR -1     // read() failed, errno is set
+#define LINE_TOO_LONG -2  // the line was skipped, reading goes on after it
+
+// reads newline-terminated lines from a descriptor into a growable buffer.
+// Lines are handed out in place: the reader keeps a cursor to the first
+// unread byte instead of moving the rest of the buffer after every line.
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t capacity;
+  size_t start;       // first byte of the next line
+  size_t end;         // end of the bytes read so far
+  size_t scanned;     // bytes after start already known to have no '\n'
+  size_t read_size;   // how much to ask read() for at a time
+  size_t max_line;    // longest line accepted, not counting the '\n'
+  int eof;
+  int discarding;     // skipping the rest of a line that was too long
+  long line_number;   // number of the line last returned
+  const char *map;    // the whole file when it is memory-mapped, else NULL
+  size_t map_size;
+} LineReader;
+
+void line_reader_init(LineReader *reader, int fd, size_t read_size,
+                      size_t max_line);
+
+// maps the reader's file into memory instead of reading it, if it is a
+// regular file. Returns 0 if it was mapped, -1 if the reader should keep
+// using read(), for example for pipes and terminals.
+int line_reader_map(LineReader *reader);
+
+// points line at the next line, which is length bytes long and stays valid
+// until the next call. When reading, the '\n' is replaced by '\0'; a mapped
+// line is read-only and has no '\0', so always go by length. A last line
+// without a '\n' is returned too. Returns one of the LINE_ values above.
+int line_reader_next(LineReader *reader, const char **line, size_t *length);
+
+void line_reader_free(LineReader *reader);
+
+#endif
@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include "memo.h"
+#include "hash.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MEMO_MAGIC "MYSHMEM1"
+#define HASH_LIMIT (64 * 1024 * 1024)   // bigger files count by their stat
+#define READ_CHUNK (128 * 1024)
+#define MAX_BYTES (256LL * 1024 * 1024) // 256mb
+#define MAX_AGE (7 * 24 * 60 * 60)      // a week
+#define SCAN_INTERVAL (60 * 60)         // other shells store entries too
+
+typedef struct {
+  char magic[8];
+  int32_t status;
+  uint32_t unused;
+} MemoHeader;
+
+static char store[PATH_MAX];
+static int store_state = 0; // 0 not looked at yet, 1 there, -1 not
+static MemoStats counters;
+// size of the store as of the last scan plus what we stored since, -1
+// before the first scan
+static long long known_bytes = -1;
+static time_t last_scan = 0;
+
+int memo_available(void) {
+  if (store_state == 0) {
+    store_state = -1;
+    const char *cache_dir = getenv("MYSH_CACHE_DIR");
+    if (cache_dir != NULL && *cache_dir != '\0' &&
+        snprintf(store, sizeof(store), "%s/memo", cache_dir) < (int)sizeof(store)) {
+      mkdir(cache_dir, 0755);
+      if (mkdir(store, 0755) == 0 || errno == EEXIST) {
+        store_state = 1;
+      }
+    }
+  }
+  return store_state == 1 ? 0 : -1;
+}
+
+static long long env_limit(const char *name, long long default_value) {
+  const char *value = getenv(name);
+  if (value == NULL || *value == '\0') {
+    return default_value;
+  }
+  char *end;
+  long long parsed = strtoll(value, &end, 10);
+  if (*end != '\0' || parsed <= 0) {
+    fprintf(stderr, "mysh: ignoring invalid %s=%s\n", name, value);
+    return default_value;
+  }
+  return parsed;
+}
+
+static void add_string(Hasher *key, const char *s) {
+  hasher_update(key, s, strlen(s) + 1);
+}
+
+// what stat says about a file, enough to tell it changed
+static void add_stat(Hasher *key, const struct stat *st) {
+  int64_t fields[6] = {st->st_size,       st->st_mtim.tv_sec,
+                       st->st_mtim.tv_nsec, st->st_ino,
+                       st->st_dev,        st->st_mode};
+  hasher_update(key, fields, sizeof(fields));
+}
+
+// a regular file by its contents, read with pread() so whoever reads fd
+// next still starts where it would have
+static void add_fd(Hasher *key, int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    add_string(key, "unreadable");
+    return;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size > HASH_LIMIT) {
+    add_stat(key, &st);
+    return;
+  }
+  char *buf = malloc(READ_CHUNK);
+  if (buf == NULL) {
+    add_stat(key, &st);
+    return;
+  }
+  int64_t size = st.st_size;
+  hasher_update(key, &size, sizeof(size));
+  off_t offset = 0;
+  for (;;) {
+    ssize_t n = pread(fd, buf, READ_CHUNK, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    hasher_update(key, buf, n);
+    offset += n;
+  }
+  free(buf);
+}
+
+static void add_path(Hasher *key, const char *path) {
+  add_string(key, path);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    add_string(key, "missing");
+    return;
+  }
+  add_fd(key, fd);
+  close(fd);
+}
+
+void memo_key(char **argv, const char *path, int in_fd, char **deps,
+              int num_deps, char hex[33]) {
+  Hasher key;
+  hasher_init(&key);
+  add_string(&key, MEMO_MAGIC);
+
+  char cwd[PATH_MAX];
+  add_string(&key, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "");
+
+  // the binary changes rarely and can be big, its stat is enough
+  struct stat st;
+  add_string(&key, path);
+  if (stat(path, &st) == 0) {
+    add_stat(&key, &st);
+  }
+  for (int i = 0; argv[i] != NULL; i++) {
+    add_string(&key, argv[i]);
+  }
+  add_string(&key, "");
+
+  if (in_fd >= 0) {
+    add_fd(&key, in_fd);
+  } else {
+    add_string(&key, "no input");
+  }
+  for (int i = 0; i < num_deps; i++) {
+    add_path(&key, deps[i]);
+  }
+
+  uint64_t hash[2];
+  hasher_final(&key, hash);
+  hash_to_hex(hash, hex);
+}
+
+static void entry_path(const char *hex, char *path, size_t size) {
+  snprintf(path, size, "%s/%s.memo", store, hex);
+}
+
+// unique per process, so two shells storing the same entry don't collide
+static void temp_path(const char *hex, char *path, size_t size) {
+  snprintf(path, size, "%s/%s.%ld.tmp", store, hex, (long)getpid());
+}
+
+int memo_find(const char *hex, int *status) {
+  char path[PATH_MAX + 64];
+  entry_path(hex, path, sizeof(path));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  MemoHeader header;
+  if (fd >= 0 && (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+                  memcmp(header.magic, MEMO_MAGIC, sizeof(header.magic)) != 0 ||
+                  lseek(fd, sizeof(header), SEEK_SET) < 0)) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0) {
+    counters.misses++;
+    return -1;
+  }
+  // used now, so eviction keeps it longest
+  futimens(fd, NULL);
+  counters.hits++;
+  *status = header.status;
+  return fd;
+}
+
+int memo_begin(const char *hex) {
+  char path[PATH_MAX + 64];
+  temp_path(hex, path, sizeof(path));
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0 && lseek(fd, sizeof(MemoHeader), SEEK_SET) < 0) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  return fd;
+}
+
+int memo_commit(int fd, const char *hex, int status) {
+  MemoHeader header = {{0}, status, 0};
+  memcpy(header.magic, MEMO_MAGIC, sizeof(header.magic));
+  char temp[PATH_MAX + 64], path[PATH_MAX + 64];
+  temp_path(hex, temp, sizeof(temp));
+  entry_path(hex, path, sizeof(path));
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      lseek(fd, sizeof(header), SEEK_SET) < 0 || rename(temp, path) != 0) {
+    unlink(temp);
+    return -1;
+  }
+  struct stat st;
+  if (known_bytes >= 0 && fstat(fd, &st) == 0) {
+    known_bytes += st.st_size;
+  }
+  return 0;
+}
+
+void memo_abort(int fd, const char *hex) {
+  char temp[PATH_MAX + 64];
+  temp_path(hex, temp, sizeof(temp));
+  unlink(temp);
+  lseek(fd, sizeof(MemoHeader), SEEK_SET);
+}
+
+void memo_uncached(void) { counters.uncached++; }
+
+typedef struct {
+  char name[64];
+  time_t used;
+  long long bytes;
+} Entry;
+
+static int older_first(const void *a, const void *b) {
+  const Entry *x = a, *y = b;
+  return (x->used > y->used) - (x->used < y->used);
+}
+
+static int ends_with(const char *s, const char *suffix) {
+  size_t len = strlen(s), suffix_len = strlen(suffix);
+  return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+// every entry in the store, and temp files when with_temps is set.
+// Returns how many, the caller frees *entries.
+static int list_entries(Entry **entries, int with_temps) {
+  *entries = NULL;
+  DIR *dir = opendir(store);
+  if (dir == NULL) {
+    return 0;
+  }
+  int count = 0, cap = 0;
+  struct dirent *d;
+  while ((d = readdir(dir)) != NULL) {
+    if (strlen(d->d_name) >= sizeof((*entries)->name) ||
+        !(ends_with(d->d_name, ".memo") || (with_temps && ends_with(d->d_name, ".tmp")))) {
+      continue;
+    }
+    struct stat st;
+    if (fstatat(dirfd(dir), d->d_name, &st, 0) != 0) {
+      continue;
+    }
+    if (count == cap) {
+      cap = cap > 0 ? cap * 2 : 64;
+      Entry *grown = realloc(*entries, cap * sizeof(Entry));
+      if (grown == NULL) {
+        break;
+      }
+      *entries = grown;
+    }
+    Entry *entry = &(*entries)[count++];
+    strcpy(entry->name, d->d_name);
+    entry->used = st.st_mtime;
+    entry->bytes = st.st_size;
+  }
+  closedir(dir);
+  return count;
+}
+
+static void remove_entry(const Entry *entry) {
+  char path[PATH_MAX + 64];
+  snprintf(path, sizeof(path), "%s/%s", store, entry->name);
+  unlink(path);
+}
+
+void memo_evict(void) {
+  if (memo_available() != 0) {
+    return;
+  }
+  long long max_age = env_limit("MYSH_MEMO_MAX_AGE", MAX_AGE);
+  long long max_bytes = env_limit("MYSH_MEMO_MAX_BYTES", MAX_BYTES);
+  time_t now = time(NULL);
+  long long interval = max_age < SCAN_INTERVAL ? max_age : SCAN_INTERVAL;
+  if (known_bytes >= 0 && known_bytes <= max_bytes && now - last_scan < interval) {
+    return;
+  }
+  counters.scans++;
+  last_scan = now;
+
+  // a temp file that old was left by a shell that died while storing
+  Entry *entries;
+  int count = list_entries(&entries, 1);
+  int kept = 0;
+  long long total = 0;
+  for (int i = 0; i < count; i++) {
+    if (now - entries[i].used > max_age) {
+      remove_entry(&entries[i]);
+    } else if (ends_with(entries[i].name, ".memo")) {
+      total += entries[i].bytes;
+      entries[kept++] = entries[i];
+    }
+  }
+  if (total > max_bytes) {
+    qsort(entries, kept, sizeof(Entry), older_first);
+    for (int i = 0; i < kept && total > max_bytes; i++) {
+      remove_entry(&entries[i]);
+      total -= entries[i].bytes;
+    }
+  }
+  known_bytes = total;
+  free(entries);
+}
+
+void memo_stats(MemoStats *stats) {
+  *stats = counters;
+  stats->entries = 0;
+  stats->bytes = 0;
+  if (memo_available() != 0) {
+    return;
+  }
+  Entry *entries;
+  int count = list_entries(&entries, 0);
+  for (int i = 0; i < count; i++) {
+    stats->bytes += entries[i].bytes;
+  }
+  stats->entries = count;
+  free(entries);
+}
+
+void memo_clear(void) {
+  if (memo_available() != 0) {
+    return;
+  }
+  Entry *entries;
+  int count = list_entries(&entries, 1);
+  for (int i = 0; i < count; i++) {
+    remove_entry(&entries[i]);
+  }
+  free(entries);
+  known_bytes = 0;
+}
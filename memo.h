@@ -0,0 +1,62 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+/*
+The store behind the memo builtin, in $MYSH_CACHE_DIR/memo. An entry is
+named after the hash of everything a command's output depends on and
+holds its exit status and stdout. Entries are written to a temp file and
+renamed into place, so a reader never sees half of one. A hit touches the
+entry's mtime, and eviction drops entries not used for MYSH_MEMO_MAX_AGE
+seconds (default a week), then the least recently used ones until the
+store is under MYSH_MEMO_MAX_BYTES (default 256mb).
+*/
+
+typedef struct {
+  unsigned long hits;     // replayed from the store
+  unsigned long misses;   // ran and stored
+  unsigned long uncached; // ran without the store
+  unsigned long scans;    // times eviction went through the whole store
+  int entries;
+  long long bytes;
+} MemoStats;
+
+// 0 if MYSH_CACHE_DIR is set and the store could be made
+int memo_available(void);
+
+// the key of running path with argv in the current directory: every arg,
+// the binary's size, mtime and inode, and the contents of in_fd (or -1 for
+// no input) and of each dependency. Files over 64mb count by size, mtime
+// and inode instead of contents, directories by mtime.
+void memo_key(char **argv, const char *path, int in_fd, char **deps,
+              int num_deps, char hex[33]);
+
+// opens the entry for key, positioned at its stdout, and gets its status.
+// -1 if there is none.
+int memo_find(const char *hex, int *status);
+
+// starts an entry, returns the fd the command's stdout should go to
+int memo_begin(const char *hex);
+
+// puts the finished entry in place. fd stays open and is positioned at the
+// stdout, for replaying it. -1 if it couldn't, the entry is dropped then.
+int memo_commit(int fd, const char *hex, int status);
+
+// drops an entry that was begun. fd stays open and is positioned at the
+// stdout, so what the command wrote can still be passed on.
+void memo_abort(int fd, const char *hex);
+
+// counts a command run without the store
+void memo_uncached(void);
+
+// drops old entries, then the least recently used over the size limit.
+// The store is only gone through when the entries this shell stored may
+// have taken it over the limit, or the last time was an hour ago, so a
+// miss doesn't cost a look at every entry.
+void memo_evict(void);
+
+void memo_stats(MemoStats *stats);
+
+// removes every entry
+void memo_clear(void);
+
+#endif
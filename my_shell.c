@@ -1,114 +1,492 @@
+#define _POSIX_C_SOURCE 200809L
+#include "arena.h"
 #include "parser.h"
 #include "executor.h"
+#include "jobs.h"
+#include "line_reader.h"
+#include "output.h"
+#include "pool.h"
+#include "script_cache.h"
+#include "server.h"
+#include "spawner.h"
+#include "trace.h"
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-#define BUFFER_SIZE 1024 // 1kb
+#define TTY_READ_SIZE 1024           // 1kb, a terminal hands us a line at a time
+#define SCRIPT_READ_SIZE (64 * 1024) // 64kb
+#define MAX_LINE (1024 * 1024)       // 1mb
 
-int main(int argc, char *argv[]) {
-  int input_fd;
+// reads a size from the environment, falls back to default_size
+static size_t env_size(const char *name, size_t default_size) {
+  const char *value = getenv(name);
+  if (value == NULL || *value == '\0') {
+    return default_size;
+  }
+  char *end;
+  long long parsed = strtoll(value, &end, 10);
+  if (*end != '\0' || parsed <= 0) {
+    fprintf(stderr, "mysh: ignoring invalid %s=%s\n", name, value);
+    return default_size;
+  }
+  return (size_t)parsed;
+}
 
-  if (argc == 1) {
-    // no input, so enter interactive mode
-    input_fd = STDIN_FILENO;
-  } else if (argc == 2) {
-    input_fd = open(argv[1], O_RDONLY);
-    if (input_fd < 0) {
-      // error: couldn't open file
-      perror("mysh");
+// where commands come from: lines read and parsed as we go, or a script
+// compiled by the cache
+typedef struct {
+  LineReader reader;
+  CompiledScript compiled;
+  int use_compiled;
+  long line_number; // of the last command handed out
+} Input;
+
+// what parse_end says about a line: how many stages and args, which
+// redirections and flags
+static void trace_parsed(const ParsedCmd *cmd) {
+  if (cmd == NULL) {
+    trace_event("parse_end", "\"stages\":0");
+    return;
+  }
+  char argc[256];
+  int len = 0;
+  for (int i = 0; i < cmd->num_commands && len < (int)sizeof(argc) - 16; i++) {
+    len += snprintf(argc + len, sizeof(argc) - len, "%s%d", i > 0 ? "," : "",
+                    cmd->commands[i].num_args);
+  }
+  trace_event("parse_end",
+              "\"stages\":%d,\"argc\":[%s],\"in\":%d,\"out\":%d,\"and\":%d,"
+              "\"or\":%d,\"bg\":%d,\"timed\":%d",
+              cmd->num_commands, argc,
+              cmd->input_file != NULL || cmd->input_text != NULL,
+              cmd->output_file != NULL, cmd->is_and, cmd->is_or,
+              cmd->is_background, cmd->is_timed);
+}
+
+// NextLine over a LineReader, for the body of a <<
+static int next_body_line(void *reader, const char **line, size_t *length) {
+  return line_reader_next(reader, line, length);
+}
+
+// gets the next command, NULL for blank lines. A << takes the lines after
+// it as its body. Returns one of the LINE_ values, like line_reader_next().
+static int next_command(Input *input, Arena *arena, ParsedCmd **cmd) {
+  *cmd = NULL;
+  if (input->use_compiled) {
+    if (input->line_number >= input->compiled.num_lines) {
+      return LINE_EOF;
+    }
+    if (trace_enabled) {
+      trace_set_line(input->line_number + 1);
+      trace_event("parse_start", "\"from\":\"cache\"");
+    }
+    int got = script_cache_line(&input->compiled, input->line_number++, arena, cmd);
+    if (trace_enabled && got == LINE_OK) {
+      trace_parsed(*cmd);
+    }
+    return got;
+  }
+
+  const char *cmd_line;
+  size_t line_len;
+  int got = line_reader_next(&input->reader, &cmd_line, &line_len);
+  input->line_number = input->reader.line_number;
+  if (got == LINE_OK) {
+    if (trace_enabled) {
+      trace_set_line(input->line_number);
+      trace_event("parse_start", "\"from\":\"text\"");
+    }
+    *cmd = parse_line(cmd_line, line_len, arena);
+    if (*cmd != NULL && (*cmd)->here_doc_end != NULL) {
+      int body = parse_here_doc(*cmd, next_body_line, &input->reader, arena);
+      if (body < 0) {
+        // the line can't run without all of its body
+        *cmd = NULL;
+        got = body;
+      }
+    }
+    if (trace_enabled) {
+      trace_parsed(*cmd);
+    }
+  }
+  return got;
+}
+
+// a single command with exactly these args and nothing else on the line
+static int is_line(const ParsedCmd *cmd, int num_args, const char *first,
+                   const char *second) {
+  if (cmd == NULL || cmd->num_commands != 1 || cmd->input_file != NULL ||
+      cmd->input_text != NULL || cmd->here_doc_end != NULL ||
+      cmd->output_file != NULL || cmd->is_background || cmd->is_timed) {
+    return 0;
+  }
+  Command *command = &cmd->commands[0];
+  return command->num_args == num_args && strcmp(command->args[0], first) == 0 &&
+         (second == NULL || strcmp(command->args[1], second) == 0);
+}
+
+// what the tasks of a parallel block share
+typedef struct {
+  ParsedCmd **cmds;
+  int prev_state;
+} Block;
+
+// pool task, runs one line of a parallel block
+static int run_block_line(void *arg, int index) {
+  Block *block = arg;
+  int should_exit = 0;
+  return execute(block->cmds[index], block->prev_state, 0, &should_exit);
+}
+
+/*
+Reads the lines of a parallel block up to its closing } into block_arena,
+then runs them all at once on a pool with a worker per core, or
+MYSH_JOBS workers. Each line's
+output comes out in one piece when it finishes. Returns EXIT_SUCCESS if
+every line succeeded and EXIT_FAILURE if any failed. start is the
+"parallel {" line, its and/or decides whether the block runs at all.
+*/
+static int run_parallel_block(Input *input, Arena *block_arena,
+                              const ParsedCmd *start, int prev_state,
+                              int is_interactive) {
+  int skip = (prev_state == EXIT_SUCCESS && start->is_or) ||
+             (prev_state == EXIT_FAILURE && start->is_and);
+  long start_line = input->line_number;
+  int broken = 0;
+  int depth = 1;
+
+  ParsedCmd **cmds = NULL;
+  int num_cmds = 0, cmds_cap = 0;
+  while (depth > 0) {
+    if (is_interactive) {
+      printf("> ");
+      output_flush();
+    }
+    ParsedCmd *cmd;
+    int got = next_command(input, block_arena, &cmd);
+    if (got == LINE_EOF || got == LINE_ERROR) {
+      fprintf(stderr, "mysh: parallel block on line %ld has no closing }\n",
+              start_line);
+      free(cmds);
       return EXIT_FAILURE;
     }
+    if (got == LINE_TOO_LONG) {
+      fprintf(stderr, "mysh: line %ld is longer than %zu bytes\n",
+              input->line_number, input->reader.max_line);
+      broken = 1;
+      continue;
+    }
+    if (is_line(cmd, 1, "}", NULL)) {
+      depth--;
+      continue;
+    }
+    if (is_line(cmd, 2, "parallel", "{")) {
+      fprintf(stderr, "mysh: line %ld: parallel blocks don't nest\n",
+              input->line_number);
+      broken = 1;
+      depth++;
+      continue;
+    }
+    if (cmd == NULL || depth > 1) {
+      continue;
+    }
+    if (num_cmds == cmds_cap) {
+      cmds_cap = cmds_cap > 0 ? cmds_cap * 2 : 16;
+      ParsedCmd **grown = realloc(cmds, cmds_cap * sizeof(ParsedCmd *));
+      if (grown == NULL) {
+        perror("mysh");
+        free(cmds);
+        return EXIT_FAILURE;
+      }
+      cmds = grown;
+    }
+    cmds[num_cmds++] = cmd;
+  }
+
+  if (skip) {
+    free(cmds);
+    return prev_state;
+  }
+  if (broken) {
+    free(cmds);
+    return EXIT_FAILURE;
+  }
+
+  int result = EXIT_SUCCESS;
+  if (num_cmds > 0) {
+    int *statuses = malloc(num_cmds * sizeof(int));
+    Block block = {cmds, prev_state};
+    if (statuses == NULL ||
+        pool_run(env_size("MYSH_JOBS", pool_default_jobs()), num_cmds,
+                 run_block_line, &block, statuses) > 0) {
+      result = EXIT_FAILURE;
+    }
+    free(statuses);
   }
+  free(cmds);
+  return result;
+}
 
+// runs the commands read from input_fd until EOF, or exits the process for
+// exit and die. is_script is set when input_fd is a script file.
+// last_state, if not NULL, gets the status of the last line.
+static int run_input(int input_fd, int is_script, int *last_state) {
   int is_interactive = isatty(input_fd);
-  char buffer[BUFFER_SIZE];
-  int buffer_len = 0;
   int prev_state = 0;
 
+  // MYSH_READ_SIZE and MYSH_MAX_LINE tune the reader for big scripts
+  Input input = {0};
+  LineReader *reader = &input.reader;
+  line_reader_init(reader,
+                   input_fd,
+                   env_size("MYSH_READ_SIZE",
+                            is_interactive ? TTY_READ_SIZE : SCRIPT_READ_SIZE),
+                   env_size("MYSH_MAX_LINE", MAX_LINE));
+
+  // scripts that are regular files are mapped and parsed straight out of
+  // the page cache, pipes and terminals keep going through read().
+  // With MYSH_CACHE_DIR set a mapped script is compiled once and later
+  // runs load the parsed lines from the cache instead.
+  if (is_script && line_reader_map(reader) == 0) {
+    const char *cache_dir = getenv("MYSH_CACHE_DIR");
+    if (cache_dir != NULL && *cache_dir != '\0') {
+      input.use_compiled =
+          script_cache_open(&input.compiled, cache_dir, reader->map,
+                            reader->map_size, reader->max_line) == 0;
+    }
+  }
+
+  // everything a line needs is allocated here and dropped once it has run
+  Arena line_arena;
+  arena_init(&line_arena, 4096);
+  // the lines of a parallel block, kept until the whole block has run
+  Arena block_arena;
+  arena_init(&block_arena, 4096);
+
   if (is_interactive) {
     printf("Welcome to mysh!\n");
   }
 
   while (true) {
     if (is_interactive) {
+      // report background jobs that finished since the last prompt
+      jobs_notify();
+      // a user at the prompt wants the trace of the last line now
+      trace_flush();
       printf("mysh> ");
-      fflush(stdout);
+      output_flush();
     }
 
     // read input
-    ssize_t bytes_read = read(input_fd, buffer + buffer_len, BUFFER_SIZE - buffer_len);
+    ParsedCmd *cmd;
+    int got = next_command(&input, &line_arena, &cmd);
 
-    if (bytes_read == 0) {
-      // EOF
+    if (got == LINE_EOF) {
       break;
     }
 
-    if (bytes_read < 0) {
+    if (got == LINE_ERROR) {
       // error in read
       perror("read");
       break;
     }
 
-    buffer_len += bytes_read;
-
-    while (1) {
-      char *newline_pos = memchr(buffer, '\n', buffer_len);
+    if (got == LINE_TOO_LONG) {
+      // the reader skipped it, carry on as if the command failed
+      fprintf(stderr, "mysh: line %ld is longer than %zu bytes\n",
+              input.line_number, reader->max_line);
+      prev_state = EXIT_FAILURE;
+      continue;
+    }
 
-      if (newline_pos == NULL) {
-        break;
-      }
+    if (is_line(cmd, 2, "parallel", "{")) {
+      prev_state = run_parallel_block(&input, &block_arena, cmd, prev_state,
+                                      is_interactive);
+      arena_reset(&block_arena);
+      arena_reset(&line_arena);
+      continue;
+    }
 
-      int line_len = newline_pos - buffer;
-      char cmd_line[line_len + 1];
-      memcpy(cmd_line, buffer, line_len);
-      cmd_line[line_len] = '\0';
+    int should_exit = 0;
+    int finalState = execute(cmd, prev_state, is_interactive, &should_exit);
+    prev_state = finalState;
+    output_line_done();
+    arena_reset(&line_arena);
+    if (trace_enabled && cmd != NULL) {
+      trace_event("line_done", "\"status\":%d", finalState);
+    }
 
-      // Place holder for parse/execute
-      //printf("Got command: [%s]\n", cmd_line);
+    // check for exit/die
+    if (should_exit) {
+      printf("Exiting mysh...\n");
+      exit(finalState);
+    }
+  }
 
-      // TODO: implement
-      ParsedCmd *cmd = parse(cmd_line);
+  if (is_interactive) {
+    printf("Goodbye!\n");
+  }
 
-      int should_exit = 0;
-      int finalState = execute(cmd, prev_state, is_interactive, &should_exit);
-      prev_state = finalState;
-      // TODO: implement
-      // execute cmd here
+  if (last_state != NULL) {
+    *last_state = prev_state;
+  }
+  script_cache_close(&input.compiled);
+  line_reader_free(reader);
+  arena_free(&line_arena);
+  arena_free(&block_arena);
 
-      // TODO: implement
-      /* free_parsed_cmd(cmd); */
+  return EXIT_SUCCESS;
+}
 
-      free_parsed_cmd(cmd);
-      // check for exit/die
+static int run_script(const char *path) {
+  int input_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (input_fd < 0) {
+    // error: couldn't open file
+    perror("mysh");
+    return EXIT_FAILURE;
+  }
+  // like sh, a script's status is that of its last line
+  int last_state = EXIT_SUCCESS;
+  run_input(input_fd, 1, &last_state);
+  close(input_fd);
+  return last_state;
+}
 
-      // shift buffer
-      int remaining = buffer_len - (line_len + 1);
-      memmove(buffer, newline_pos + 1, remaining);
-      buffer_len = remaining;
+// runs the script of a --serve request, its status goes to the client
+static int run_request(int script_fd) {
+  int last_state = EXIT_SUCCESS;
+  run_input(script_fd, 1, &last_state);
+  close(script_fd);
+  return last_state;
+}
 
-      if (should_exit) {
-        printf("Exiting mysh...\n");
-        exit(finalState);
-      }
+// mysh --client path script, or mysh --client path -c line
+static int run_client(const char *path, int argc, char *argv[]) {
+  if (argc == 2 && strcmp(argv[0], "-c") == 0) {
+    size_t length = strlen(argv[1]);
+    char *line = malloc(length + 2);
+    if (line == NULL) {
+      perror("mysh");
+      return EXIT_FAILURE;
     }
+    memcpy(line, argv[1], length);
+    line[length] = '\n';
+    int status = serve_client(path, line, length + 1);
+    free(line);
+    return status;
+  }
 
-    if (buffer_len >= BUFFER_SIZE) {
-      // error: line too long
+  int fd = open(argv[0], O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    perror("mysh");
+    return EXIT_FAILURE;
+  }
+  struct stat st;
+  char *script = NULL;
+  if (fstat(fd, &st) == 0) {
+    script = malloc(st.st_size > 0 ? st.st_size : 1);
+  }
+  size_t length = 0;
+  while (script != NULL && length < (size_t)st.st_size) {
+    ssize_t n = read(fd, script + length, st.st_size - length);
+    if (n <= 0) {
       break;
     }
+    length += n;
+  }
+  close(fd);
+  if (script == NULL) {
+    perror("mysh");
+    return EXIT_FAILURE;
   }
+  int status = serve_client(path, script, length);
+  free(script);
+  return status;
+}
 
-  if (is_interactive) {
-    printf("Goodbye!\n");
+// pool task, runs one of the scripts given to --jobs
+static int run_script_task(void *arg, int index) {
+  char **scripts = arg;
+  return run_script(scripts[index]);
+}
+
+// runs every script in its own worker, at most jobs at a time, then sums
+// up how they went on stderr
+static int run_jobs(int jobs, int num_scripts, char **scripts) {
+  int *statuses = malloc(num_scripts * sizeof(int));
+  if (statuses == NULL) {
+    perror("mysh");
+    return EXIT_FAILURE;
   }
+  int failed = pool_run(jobs, num_scripts, run_script_task, scripts, statuses);
 
+  for (int i = 0; i < num_scripts; i++) {
+    int status = statuses[i];
+    if (status == -1) {
+      fprintf(stderr, "mysh: %s: not run\n", scripts[i]);
+    } else if (WIFSIGNALED(status)) {
+      fprintf(stderr, "mysh: %s: killed by signal %d\n", scripts[i],
+              WTERMSIG(status));
+    } else if (WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "mysh: %s: exited with %d\n", scripts[i],
+              WEXITSTATUS(status));
+    }
+  }
+  fprintf(stderr, "mysh: %d scripts, %d succeeded, %d failed\n", num_scripts,
+          num_scripts - failed, failed);
+
+  free(statuses);
+  return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+  trace_init();
+  // before anything grows, a zygote forked later would copy all of it
+  spawner_init();
+  output_init();
+  if (argc == 1) {
+    // no input, so enter interactive mode
+    return run_input(STDIN_FILENO, 0, NULL);
+  }
   if (argc == 2) {
-    close(input_fd);
+    return run_script(argv[1]);
   }
 
-  return EXIT_SUCCESS;
+  // mysh --jobs N script...
+  if (strcmp(argv[1], "--jobs") == 0) {
+    char *end;
+    long jobs = strtol(argv[2], &end, 10);
+    if (*end != '\0' || jobs <= 0 || jobs > 4096) {
+      fprintf(stderr, "mysh: invalid job count: %s\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+    if (argc > 3) {
+      return run_jobs(jobs, argc - 3, argv + 3);
+    }
+  }
+
+  // mysh --serve path
+  if (strcmp(argv[1], "--serve") == 0 && argc == 3) {
+    return serve(argv[2], run_request);
+  }
+
+  // mysh --client path script, mysh --client path -c line
+  if (strcmp(argv[1], "--client") == 0 && (argc == 4 || argc == 5)) {
+    if (argc == 4 || strcmp(argv[3], "-c") == 0) {
+      return run_client(argv[2], argc - 3, argv + 3);
+    }
+  }
+
+  fprintf(stderr, "usage: mysh [script]\n"
+                  "       mysh --jobs N script...\n"
+                  "       mysh --serve socket\n"
+                  "       mysh --client socket script\n"
+                  "       mysh --client socket -c line\n");
+  return EXIT_FAILURE;
 }
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include "output.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER (16 * 1024)
+
+static char buffer[OUTPUT_BUFFER];
+static size_t buffered = 0;
+static int flush_lines = 1; // flush at every line end, until output_init()
+static int initialized = 0;
+
+// writes all of the pieces, going on after short writes
+static int write_all(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t n = writev(fd, iov, count);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    while (count > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+// a forked child starts with the parent's unwritten output, which is the
+// parent's to write
+static void forget_after_fork(void) { buffered = 0; }
+
+static void flush_at_exit(void) { output_flush(); }
+
+void output_init(void) {
+  if (!initialized) {
+    initialized = 1;
+    pthread_atfork(NULL, NULL, forget_after_fork);
+    atexit(flush_at_exit);
+  }
+  output_flush();
+  struct stat out, err;
+  flush_lines = isatty(STDOUT_FILENO) ||
+                (fstat(STDOUT_FILENO, &out) == 0 && fstat(STDERR_FILENO, &err) == 0 &&
+                 out.st_dev == err.st_dev && out.st_ino == err.st_ino);
+}
+
+ssize_t output_write(int fd, const void *data, size_t len) {
+  if (fd != STDOUT_FILENO || !initialized) {
+    // everything that went to fd 1 before has to come out first
+    if (fd == STDOUT_FILENO && output_flush() != 0) {
+      return -1;
+    }
+    struct iovec iov = {(void *)data, len};
+    return write_all(fd, &iov, 1) == 0 ? (ssize_t)len : -1;
+  }
+  if (len <= sizeof(buffer) - buffered) {
+    memcpy(buffer + buffered, data, len);
+    buffered += len;
+    return len;
+  }
+  struct iovec iov[2] = {{buffer, buffered}, {(void *)data, len}};
+  buffered = 0;
+  return write_all(fd, iov, 2) == 0 ? (ssize_t)len : -1;
+}
+
+int output_flush(void) {
+  int result = 0;
+  if (buffered > 0) {
+    struct iovec iov = {buffer, buffered};
+    buffered = 0;
+    result = write_all(STDOUT_FILENO, &iov, 1);
+  }
+  // stdio's stdout was written after anything buffered here
+  if (fflush(stdout) != 0) {
+    result = -1;
+  }
+  return result;
+}
+
+void output_line_done(void) {
+  if (flush_lines) {
+    output_flush();
+  }
+}
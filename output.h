@@ -0,0 +1,36 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <sys/types.h>
+
+/*
+What builtins run by the shell itself write to its stdout is collected
+here, so a script of echo and printf lines costs a write per buffer, not
+one per line. A write that doesn't fit goes out together with what is
+buffered in one writev(). Buffered output is written:
+
+  - before the shell forks or spawns, so it comes before the child's
+  - at the end of every line when stdout is a terminal, or the same file
+    as stderr, so it keeps its place among error messages
+  - when the shell exits
+
+Only the shell's main thread writes here. Pipeline stages and redirects
+write straight to their fd, and code that writes to fd 1 itself calls
+output_flush() first.
+*/
+
+// looks at what fds 1 and 2 are, again whenever they were changed
+void output_init(void);
+
+// like write(), everything or -1. Buffered for STDOUT_FILENO, so an error
+// may also be one of an earlier write.
+ssize_t output_write(int fd, const void *data, size_t len);
+
+// writes out what is buffered, then stdio's stdout. -1 if it couldn't
+int output_flush(void);
+
+// the end of a line, flushes when stdout is a terminal or shares stderr's
+// file
+void output_line_done(void);
+
+#endif
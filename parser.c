@@ -1,4 +1,4 @@
-#include "dynamic_array.h"
+#include "arena.h"
 #include "parser.h"
 #include <ctype.h>
 #include <stddef.h>
@@ -6,231 +6,422 @@
 #include <stdlib.h>
 #include <string.h>
 
-// tokenize returns a dynamic array of tokens from a string input
-// tokens are substrings separated by whitespace
-Array tokenize(const char *input) {
-  Array tokens;
+static int is_space(char c) { return c == ' ' || c == '\t'; }
 
-  initArray(&tokens, 10);
+static int is_operator(char c) {
+  return c == '<' || c == '>' || c == '|' || c == '&';
+}
 
-  int i = 0;
+// how long the operator at input[i] is: <<< and << are one token
+static int operator_length(const char *input, int length, int i) {
+  int n = 1;
+  while (input[i] == '<' && n < 3 && i + n < length && input[i + n] == '<') {
+    n++;
+  }
+  return n;
+}
 
-  while (input[i] != '\0') {
-    if (input[i] == ' ' || input[i] == '\t') {
+// 1 if the & at input[i] inside a word ends it, as in sleep 1&. In the
+// middle of a word, like a&b, it is just a character.
+static int ends_word(const char *input, int length, int i) {
+  return input[i] == '&' &&
+         (i + 1 == length || is_space(input[i + 1]) || input[i + 1] == '#');
+}
+
+// where the word at input[i] ends. A '#' inside ${...} is part of the word,
+// not a comment.
+static int word_end(const char *input, int length, int i) {
+  int depth = 0;
+  while (i < length && !is_space(input[i]) &&
+         (!is_operator(input[i]) ||
+          (input[i] == '&' && !ends_word(input, length, i))) &&
+         (input[i] != '#' || depth > 0)) {
+    if (input[i] == '$' && i + 1 < length && input[i + 1] == '{') {
+      depth++;
       i++;
-      continue;
+    } else if (input[i] == '}' && depth > 0) {
+      depth--;
+    }
+    i++;
+  }
+  return i;
+}
+
+// a word token that is exactly and / or / time
+static TokenKind word_kind(const char *word, int length) {
+  if (length == 3 && memcmp(word, "and", 3) == 0) {
+    return TOKEN_AND;
+  }
+  if (length == 2 && memcmp(word, "or", 2) == 0) {
+    return TOKEN_OR;
+  }
+  if (length == 4 && memcmp(word, "time", 4) == 0) {
+    return TOKEN_TIME;
+  }
+  return TOKEN_WORD;
+}
+
+int tokenize(const char *input, int length, Arena *arena, Token **tokens) {
+  // count first so the array is allocated once
+  int count = 0;
+  for (int i = 0; i < length && input[i] != '#';) {
+    if (is_space(input[i])) {
+      i++;
+    } else if (is_operator(input[i])) {
+      count++;
+      i += operator_length(input, length, i);
+    } else {
+      count++;
+      i = word_end(input, length, i);
     }
+  }
+
+  *tokens = arena_alloc(arena, (count + 1) * sizeof(Token));
+  if (*tokens == NULL) {
+    return -1;
+  }
 
-    if (input[i] == '<' || input[i] == '>' || input[i] == '|') {
-      char *token = (char *)malloc(sizeof(char) * 2);
-      token[0] = input[i];
-      token[1] = '\0';
-      insertArray(&tokens, token);
+  int used = 0;
+  int i = 0;
+  while (i < length && input[i] != '#') {
+    if (is_space(input[i])) {
       i++;
       continue;
     }
 
     // found a token
-    int token_start = i;
-    while (input[i] != ' ' && input[i] != '\t' && input[i] != '\0' &&
-           input[i] != '<' && input[i] != '>' && input[i] != '|') {
+    Token *token = &(*tokens)[used++];
+    token->offset = i;
+    switch (input[i]) {
+    case '<': {
+      static const TokenKind kinds[] = {TOKEN_INPUT, TOKEN_HERE_DOC,
+                                        TOKEN_HERE_STRING};
+      int n = operator_length(input, length, i);
+      token->kind = kinds[n - 1];
+      i += n;
+      break;
+    }
+    case '>':
+      token->kind = TOKEN_OUTPUT;
       i++;
+      break;
+    case '|':
+      token->kind = TOKEN_PIPE;
+      i++;
+      break;
+    case '&':
+      token->kind = TOKEN_BACKGROUND;
+      i++;
+      break;
+    default:
+      i = word_end(input, length, i);
+      token->kind = word_kind(input + token->offset, i - token->offset);
+      break;
     }
-
-    char *token = (char *)malloc(sizeof(char) * (i - token_start + 1));
-    strncpy(token, input + token_start, i - token_start);
-    token[i - token_start] = '\0';
-    insertArray(&tokens, token);
+    token->length = i - token->offset;
   }
 
-  return tokens;
+  return used;
 }
 
-// copy of strdup
-char *my_strdup(const char *s) {
-  if (s == NULL) {
-    return NULL;
-  }
-
-  size_t len = strlen(s);
-  char *new_s = (char *)malloc(len + 1);
-
-  if (new_s == NULL) {
-    return NULL;
-  }
+// true for tokens that can be an argument or a filename. and / or / time
+// are only keywords at the start of a line.
+static int is_word(const Token *token) {
+  return token->kind == TOKEN_WORD || token->kind == TOKEN_AND ||
+         token->kind == TOKEN_OR || token->kind == TOKEN_TIME;
+}
 
-  strcpy(new_s, s);
-  return new_s;
+// copies a token into the block's string pool and moves the pool forward
+static char *pool_copy(char **pool, const char *line, const Token *token) {
+  char *copy = *pool;
+  memcpy(copy, line + token->offset, token->length);
+  copy[token->length] = '\0';
+  *pool += token->length + 1;
+  return copy;
 }
 
-ParsedCmd *parse(const char *line) {
-  if (line == NULL) {
-    return NULL;
-  }
+/*
+Builds the ParsedCmd as a single block laid out as
 
-  int length = strlen(line);
-  int comment_pos = length;
-  for (int i = 0; i < length; i++) {
-    if (line[i] == '#') {
-      comment_pos = i;
-      break;
-    }
-  }
+  ParsedCmd | Command[num_commands] | char *[args + NULLs] | string pool
 
-  char *cleaned_line = (char *)malloc(sizeof(char) * (comment_pos + 1));
-  if (comment_pos > 0) {
-    strncpy(cleaned_line, line, comment_pos);
+so every pointer inside it points into the same allocation. scratch holds
+the tokens while parsing. The block comes from out, or from malloc if out
+is NULL.
+*/
+static ParsedCmd *parse_into(const char *line, size_t length, Arena *scratch,
+                             Arena *out) {
+  Token *tokens;
+  int num_tokens = tokenize(line, length, scratch, &tokens);
+  if (num_tokens < 0) {
+    return NULL;
   }
 
-  cleaned_line[comment_pos] = '\0';
-
-  Array tokens = tokenize(cleaned_line);
-
-  ParsedCmd *parsed_cmd = (ParsedCmd *)malloc(sizeof(ParsedCmd));
-  parsed_cmd->input_file = NULL;
-  parsed_cmd->output_file = NULL;
-  parsed_cmd->is_and = 0;
-  parsed_cmd->is_or = 0;
-  parsed_cmd->num_commands = 0;
-
   // check first token for conditional
+  int is_and = 0;
+  int is_or = 0;
   int token_i = 0;
-  if (tokens.used > 0) {
-    if (strcmp(tokens.array[0], "and") == 0) {
-      parsed_cmd->is_and = 1;
+  if (num_tokens > 0) {
+    if (tokens[0].kind == TOKEN_AND) {
+      is_and = 1;
       token_i = 1;
-    } else if (strcmp(tokens.array[0], "or") == 0) {
-      parsed_cmd->is_or = 1;
+    } else if (tokens[0].kind == TOKEN_OR) {
+      is_or = 1;
       token_i = 1;
     }
   }
 
-  // check if empty cmd
-  if (token_i >= tokens.used) {
-    free(parsed_cmd);
-    freeArray(&tokens);
-    free(cleaned_line);
-    return NULL;
+  // time or time -v, after the conditional
+  int is_timed = 0;
+  if (token_i < num_tokens && tokens[token_i].kind == TOKEN_TIME) {
+    is_timed = 1;
+    token_i++;
+    if (token_i < num_tokens && tokens[token_i].length == 2 &&
+        memcmp(line + tokens[token_i].offset, "-v", 2) == 0) {
+      is_timed = 2;
+      token_i++;
+    }
   }
 
-  parsed_cmd->commands = malloc(sizeof(Command) * 10);
-  int cmd_i = 0;
-
-  parsed_cmd->commands[cmd_i].args = malloc(sizeof(char *) * 10);
-  parsed_cmd->commands[cmd_i].num_args = 0;
-  parsed_cmd->num_commands = 1;
+  // a trailing & runs the line in the background
+  int is_background = 0;
+  if (num_tokens > token_i && tokens[num_tokens - 1].kind == TOKEN_BACKGROUND) {
+    is_background = 1;
+    num_tokens--;
+  }
 
-  for (int i = token_i; i < tokens.used; i++) {
-    char *token = tokens.array[i];
+  // check if empty cmd
+  if (token_i >= num_tokens) {
+    return NULL;
+  }
 
-    if (strcmp(token, "<") == 0) {
+  // first pass: check the syntax and measure the block
+  int num_commands = 1;
+  int num_args = 0;
+  int cur_args = 0;
+  size_t pool_size = 0;
+  // stdin comes from whichever of <, << and <<< is last
+  const Token *input = NULL;
+  TokenKind input_kind = TOKEN_INPUT;
+  const Token *here_doc_end = NULL;
+  const Token *output_file = NULL;
+
+  for (int i = token_i; i < num_tokens; i++) {
+    const Token *token = &tokens[i];
+
+    switch (token->kind) {
+    case TOKEN_INPUT:
+    case TOKEN_HERE_DOC:
+    case TOKEN_HERE_STRING:
+    case TOKEN_OUTPUT:
       i++;
-      if (i >= tokens.used) {
-        // error: missing filename after <
-        free_parsed_cmd(parsed_cmd);
-        freeArray(&tokens);
-        free(cleaned_line);
+      // error: missing filename after < or >, or an operator in its place
+      if (i >= num_tokens || !is_word(&tokens[i])) {
         return NULL;
       }
-
-      char *filename = tokens.array[i];
-      if (strcmp(filename, "<") == 0 || strcmp(filename, ">") == 0 ||
-          strcmp(filename, "|") == 0) {
-        free_parsed_cmd(parsed_cmd);
-        freeArray(&tokens);
-        free(cleaned_line);
-        return NULL;
+      if (token->kind == TOKEN_OUTPUT) {
+        output_file = &tokens[i];
+      } else {
+        input = &tokens[i];
+        input_kind = token->kind;
       }
-
-      parsed_cmd->input_file = my_strdup(filename);
-
-    } else if (strcmp(token, ">") == 0) {
-      i++;
-      if (i >= tokens.used) {
-        // error: missing filename after >
-        free_parsed_cmd(parsed_cmd);
-        freeArray(&tokens);
-        free(cleaned_line);
-        return NULL;
-      }
-
-      char *filename = tokens.array[i];
-      if (strcmp(filename, "<") == 0 || strcmp(filename, ">") == 0 ||
-          strcmp(filename, "|") == 0) {
-        free_parsed_cmd(parsed_cmd);
-        freeArray(&tokens);
-        free(cleaned_line);
-        return NULL;
+      // the body of a << is read even when it doesn't end up on stdin
+      if (token->kind == TOKEN_HERE_DOC) {
+        here_doc_end = &tokens[i];
       }
+      break;
 
-      parsed_cmd->output_file = my_strdup(filename);
-
-    } else if (strcmp(token, "|") == 0) {
+    case TOKEN_PIPE:
       // pipeline starts a new command
-
-      if (parsed_cmd->commands[cmd_i].num_args == 0) {
-        free_parsed_cmd(parsed_cmd);
-        freeArray(&tokens);
-        free(cleaned_line);
+      if (cur_args == 0) {
         return NULL;
       }
+      num_commands++;
+      cur_args = 0;
+      break;
 
-      // null-terminate current command's args
-      parsed_cmd->commands[cmd_i].args[parsed_cmd->commands[cmd_i].num_args] =
-          NULL;
-
-      cmd_i++;
-      parsed_cmd->commands[cmd_i].args = malloc(sizeof(char *) * 10);
-      parsed_cmd->commands[cmd_i].num_args = 0;
-      parsed_cmd->num_commands = cmd_i + 1;
+    case TOKEN_BACKGROUND:
+      // error: & anywhere but the end of the line
+      return NULL;
 
-    } else {
+    default:
       // regular argument
-      Command *curr = &parsed_cmd->commands[cmd_i];
-      curr->args[curr->num_args] = my_strdup(token);
-      curr->num_args++;
+      num_args++;
+      cur_args++;
+      pool_size += token->length + 1;
+      break;
     }
   }
 
-  if (parsed_cmd->commands[cmd_i].num_args == 0) {
-    free_parsed_cmd(parsed_cmd);
-    freeArray(&tokens);
-    free(cleaned_line);
+  if (cur_args == 0) {
     return NULL;
   }
 
-  // null terminate last command's args
-  parsed_cmd->commands[cmd_i].args[parsed_cmd->commands[cmd_i].num_args] = NULL;
-  parsed_cmd->num_commands = cmd_i + 1;
+  if (input != NULL) {
+    // a <<< word gets a '\n' like echo would give it
+    pool_size += input->length + 2;
+  }
+  if (here_doc_end != NULL) {
+    pool_size += here_doc_end->length + 1;
+  }
+  if (output_file != NULL) {
+    pool_size += output_file->length + 1;
+  }
+
+  size_t size = sizeof(ParsedCmd) + num_commands * sizeof(Command) +
+                (num_args + num_commands) * sizeof(char *) + pool_size;
+  char *block = out != NULL ? arena_alloc(out, size) : malloc(size);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  // second pass: fill the block in, copying only the bytes that end up in it
+  ParsedCmd *parsed_cmd = (ParsedCmd *)block;
+  Command *commands = (Command *)(parsed_cmd + 1);
+  char **argv = (char **)(commands + num_commands);
+  char *pool = (char *)(argv + num_args + num_commands);
+
+  parsed_cmd->commands = commands;
+  parsed_cmd->num_commands = num_commands;
+  parsed_cmd->is_and = is_and;
+  parsed_cmd->is_or = is_or;
+  parsed_cmd->is_background = is_background;
+  parsed_cmd->is_timed = is_timed;
+  parsed_cmd->input_file = NULL;
+  parsed_cmd->output_file = NULL;
+  parsed_cmd->input_text = NULL;
+  parsed_cmd->input_text_len = 0;
+  parsed_cmd->is_here_string = 0;
+  parsed_cmd->here_doc_end = NULL;
+
+  int cmd_i = 0;
+  commands[0].args = argv;
+  commands[0].num_args = 0;
+
+  for (int i = token_i; i < num_tokens; i++) {
+    switch (tokens[i].kind) {
+    case TOKEN_INPUT:
+    case TOKEN_HERE_DOC:
+    case TOKEN_HERE_STRING:
+    case TOKEN_OUTPUT:
+      // the filename was checked above, only the last one counts
+      i++;
+      break;
+    case TOKEN_PIPE:
+      // null-terminate current command's args
+      *argv++ = NULL;
+      cmd_i++;
+      commands[cmd_i].args = argv;
+      commands[cmd_i].num_args = 0;
+      break;
+    default:
+      *argv++ = pool_copy(&pool, line, &tokens[i]);
+      commands[cmd_i].num_args++;
+      break;
+    }
+  }
 
-  freeArray(&tokens);
-  free(cleaned_line);
+  // null terminate last command's args
+  *argv = NULL;
+
+  if (input != NULL && input_kind == TOKEN_INPUT) {
+    parsed_cmd->input_file = pool_copy(&pool, line, input);
+  } else if (input != NULL && input_kind == TOKEN_HERE_STRING) {
+    parsed_cmd->input_text = pool_copy(&pool, line, input);
+    parsed_cmd->input_text[input->length] = '\n';
+    parsed_cmd->input_text[input->length + 1] = '\0';
+    parsed_cmd->input_text_len = input->length + 1;
+    parsed_cmd->is_here_string = 1;
+    pool++;
+  }
+  if (here_doc_end != NULL) {
+    parsed_cmd->here_doc_end = pool_copy(&pool, line, here_doc_end);
+  }
+  if (output_file != NULL) {
+    parsed_cmd->output_file = pool_copy(&pool, line, output_file);
+  }
 
   return parsed_cmd;
 }
 
-void free_parsed_cmd(ParsedCmd *cmd) {
-  if (cmd == NULL) {
-    return;
+ParsedCmd *parse(const char *line) {
+  // tokens only live for one call, so one scratch arena is enough
+  static Arena scratch;
+  static int scratch_ready = 0;
+  if (!scratch_ready) {
+    arena_init(&scratch, 4096);
+    scratch_ready = 1;
   }
 
-  for (int i = 0; i < cmd->num_commands; i++) {
-    for (int j = 0; j < cmd->commands[i].num_args; j++) {
-      free(cmd->commands[i].args[j]);
-    }
-    free(cmd->commands[i].args);
+  if (line == NULL) {
+    return NULL;
   }
+  ParsedCmd *parsed_cmd = parse_into(line, strlen(line), &scratch, NULL);
+  arena_reset(&scratch);
+  return parsed_cmd;
+}
 
-  if (cmd->commands != NULL) {
-    free(cmd->commands);
+ParsedCmd *parse_arena(const char *line, Arena *arena) {
+  if (line == NULL) {
+    return NULL;
   }
+  return parse_into(line, strlen(line), arena, arena);
+}
+
+ParsedCmd *parse_line(const char *line, size_t length, Arena *arena) {
+  return parse_into(line, length, arena, arena);
+}
 
-  if (cmd->input_file != NULL) {
-    free(cmd->input_file);
+int parse_here_doc(ParsedCmd *cmd, NextLine next_line, void *source,
+                   Arena *arena) {
+  size_t end_len = strlen(cmd->here_doc_end);
+  int keep = cmd->input_file == NULL && cmd->input_text == NULL;
+  char *body = NULL;
+  size_t len = 0, capacity = 0;
+  int result = 0;
+  const char *line;
+  size_t length;
+  int got;
+  while ((got = next_line(source, &line, &length)) > 0) {
+    if (length == end_len && memcmp(line, cmd->here_doc_end, end_len) == 0) {
+      break;
+    }
+    if (!keep || result != 0) {
+      continue;
+    }
+    if (len + length + 1 > capacity) {
+      size_t grown = capacity > 0 ? capacity * 2 : 4096;
+      while (grown < len + length + 1) {
+        grown *= 2;
+      }
+      char *bigger = realloc(body, grown);
+      if (bigger == NULL) {
+        // the rest of the body still has to be skipped
+        result = -1;
+        continue;
+      }
+      body = bigger;
+      capacity = grown;
+    }
+    memcpy(body + len, line, length);
+    body[len + length] = '\n';
+    len += length + 1;
   }
-  if (cmd->output_file != NULL) {
-    free(cmd->output_file);
+  if (got < 0) {
+    result = got;
   }
+  if (keep && result == 0) {
+    cmd->input_text = arena_strndup(arena, body != NULL ? body : "", len);
+    cmd->input_text_len = len;
+    if (cmd->input_text == NULL) {
+      result = -1;
+    }
+  }
+  free(body);
+  return result;
+}
 
+void free_parsed_cmd(ParsedCmd *cmd) {
+  // everything lives in the one block
   free(cmd);
 }
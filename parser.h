@@ -1,6 +1,8 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "arena.h"
+
 typedef struct {
   char **args;
   int num_args;
@@ -13,11 +15,67 @@ typedef struct ParsedCmd {
   char *input_file;
   char *output_file;
 
+  // the body of a << or <<<, fed to stdin instead of input_file. Not
+  // '\0'-terminated when it comes from a compiled script, go by the length
+  char *input_text;
+  size_t input_text_len;
+  int is_here_string; // input_text is a <<< word, expanded when the line runs
+  // the delimiter of a <<, its body comes from parse_here_doc()
+  char *here_doc_end;
+
   int is_and;
   int is_or;
+  int is_background; // the line ended with &
+  int is_timed;      // 1 after time, 2 after time -v
 } ParsedCmd;
 
+typedef enum {
+  TOKEN_WORD,
+  TOKEN_INPUT,       // <
+  TOKEN_HERE_DOC,    // <<
+  TOKEN_HERE_STRING, // <<<
+  TOKEN_OUTPUT,      // >
+  TOKEN_PIPE,        // |
+  TOKEN_BACKGROUND,  // &
+  TOKEN_AND,         // the word "and"
+  TOKEN_OR,          // the word "or"
+  TOKEN_TIME         // the word "time"
+} TokenKind;
+
+// a token is a span of the line it came from, nothing is copied
+typedef struct {
+  int offset;
+  int length;
+  TokenKind kind;
+} Token;
+
+// splits the first length bytes of line into tokens, stopping at a '#'
+// that isn't inside ${...}.
+// The token array comes from arena. Returns the number of tokens or -1.
+int tokenize(const char *line, int length, Arena *arena, Token **tokens);
+
+// the whole ParsedCmd is one allocation, release it with free_parsed_cmd()
 ParsedCmd *parse(const char *line);
 void free_parsed_cmd(ParsedCmd *cmd);
 
+// same as parse(), but everything comes from arena and is released by
+// arena_reset(). Don't call free_parsed_cmd() on the result.
+ParsedCmd *parse_arena(const char *line, Arena *arena);
+
+// parse_arena() for the first length bytes of line, which doesn't need a
+// '\0' at the end. This lets lines be parsed straight out of a mapped file.
+ParsedCmd *parse_line(const char *line, size_t length, Arena *arena);
+
+// hands out the next line of input like line_reader_next(): > 0 with line
+// set, 0 at the end, < 0 for an error
+typedef int (*NextLine)(void *source, const char **line, size_t *length);
+
+// reads the body of cmd's << from next_line: every line up to one that is
+// exactly cmd->here_doc_end, or to the end of the input. Each line gets a
+// '\n'. The body goes into arena and becomes cmd's input_text, unless a
+// later < or <<< on the line takes stdin. Returns 0, or the error
+// next_line gave (-1 if out of memory).
+int parse_here_doc(ParsedCmd *cmd, NextLine next_line, void *source,
+                   Arena *arena);
+
 #endif
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include "path_cache.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PATH_MAX_LEN 1024
+#define INITIAL_SLOTS 64 // must be a power of two
+
+// shell-wide table from command name to resolved path, so a script that
+// runs the same command many times only searches the directories once.
+// Misses are remembered too (path == NULL) until the table is cleared.
+typedef struct {
+  char *name;      // NULL if the slot is empty
+  char *path;      // NULL if the command was not found
+  uint32_t hash;
+  unsigned long hits;
+} Entry;
+
+static Entry *slots = NULL;
+static size_t num_slots = 0;
+static size_t used = 0;
+static unsigned long total_hits = 0;
+static unsigned long total_misses = 0;
+
+// paths a seed replaced, callers may still hold them until the clear
+static char **retired = NULL;
+static size_t num_retired = 0;
+
+static const char *directories[] = {"/usr/local/bin", "/usr/bin", "/bin"};
+
+// 32 bit FNV-1a
+static uint32_t hash_name(const char *name) {
+  uint32_t h = 2166136261u;
+  for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// searches the directories, returns a new string or NULL
+static char *resolve(const char *name) {
+  char buffer[PATH_MAX_LEN];
+  for (size_t i = 0; i < sizeof(directories) / sizeof(directories[0]); i++) {
+    int len = snprintf(buffer, sizeof(buffer), "%s/%s", directories[i], name);
+    if (len < 0 || len >= (int)sizeof(buffer)) {
+      continue;
+    }
+    // check that the file exists and is executable
+    if (access(buffer, X_OK) == 0) {
+      char *result = malloc(len + 1);
+      if (result != NULL) {
+        memcpy(result, buffer, len + 1);
+      }
+      return result;
+    }
+  }
+  return NULL;
+}
+
+// returns the slot holding name, or the empty slot where it belongs
+static Entry *find_slot(Entry *table, size_t size, const char *name,
+                        uint32_t hash) {
+  size_t i = hash & (size - 1);
+  while (table[i].name != NULL) {
+    if (table[i].hash == hash && strcmp(table[i].name, name) == 0) {
+      return &table[i];
+    }
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static int grow(void) {
+  size_t new_size = num_slots == 0 ? INITIAL_SLOTS : num_slots * 2;
+  Entry *table = calloc(new_size, sizeof(Entry));
+  if (table == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < num_slots; i++) {
+    if (slots[i].name != NULL) {
+      *find_slot(table, new_size, slots[i].name, slots[i].hash) = slots[i];
+    }
+  }
+  free(slots);
+  slots = table;
+  num_slots = new_size;
+  return 0;
+}
+
+// adds a name that is not in the table yet, takes ownership of path
+static Entry *insert(const char *name, uint32_t hash, char *path) {
+  // keep the load factor under 3/4
+  if ((used + 1) * 4 > num_slots * 3 && grow() != 0) {
+    free(path);
+    return NULL;
+  }
+  Entry *entry = find_slot(slots, num_slots, name, hash);
+  entry->name = malloc(strlen(name) + 1);
+  if (entry->name == NULL) {
+    free(path);
+    return NULL;
+  }
+  strcpy(entry->name, name);
+  entry->path = path;
+  entry->hash = hash;
+  entry->hits = 0;
+  used++;
+  return entry;
+}
+
+const char *path_cache_lookup(const char *name) {
+  uint32_t hash = hash_name(name);
+  if (num_slots > 0) {
+    Entry *entry = find_slot(slots, num_slots, name, hash);
+    if (entry->name != NULL) {
+      total_hits++;
+      entry->hits++;
+      return entry->path;
+    }
+  }
+
+  total_misses++;
+  Entry *entry = insert(name, hash, resolve(name));
+  if (entry == NULL) {
+    // out of memory, answer without caching
+    return NULL;
+  }
+  return entry->path;
+}
+
+int path_cache_seed(const char *name) {
+  uint32_t hash = hash_name(name);
+  char *path = resolve(name);
+  if (num_slots > 0) {
+    Entry *entry = find_slot(slots, num_slots, name, hash);
+    if (entry->name != NULL) {
+      if (path != NULL && entry->path != NULL && strcmp(path, entry->path) == 0) {
+        free(path);
+        return 0;
+      }
+      if (entry->path != NULL) {
+        char **grown = realloc(retired, (num_retired + 1) * sizeof(char *));
+        if (grown == NULL) {
+          free(path);
+          return -1;
+        }
+        retired = grown;
+        retired[num_retired++] = entry->path;
+      }
+      entry->path = path;
+      return path == NULL ? -1 : 0;
+    }
+  }
+  int found = path != NULL;
+  if (insert(name, hash, path) == NULL) {
+    return -1;
+  }
+  return found ? 0 : -1;
+}
+
+void path_cache_clear(void) {
+  for (size_t i = 0; i < num_slots; i++) {
+    free(slots[i].name);
+    free(slots[i].path);
+  }
+  free(slots);
+  slots = NULL;
+  num_slots = 0;
+  used = 0;
+  for (size_t i = 0; i < num_retired; i++) {
+    free(retired[i]);
+  }
+  free(retired);
+  retired = NULL;
+  num_retired = 0;
+}
+
+void path_cache_print(int fd) {
+  for (size_t i = 0; i < num_slots; i++) {
+    if (slots[i].name != NULL && slots[i].path != NULL) {
+      dprintf(fd, "%lu\t%s\n", slots[i].hits, slots[i].path);
+    }
+  }
+}
+
+void path_cache_stats(PathCacheStats *stats) {
+  stats->hits = total_hits;
+  stats->misses = total_misses;
+  stats->entries = (int)used;
+  stats->negative = 0;
+  for (size_t i = 0; i < num_slots; i++) {
+    if (slots[i].name != NULL && slots[i].path == NULL) {
+      stats->negative++;
+    }
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+typedef struct {
+  unsigned long hits;     // lookups answered from the table
+  unsigned long misses;   // lookups that had to search the directories
+  int entries;            // names in the table, found or not
+  int negative;           // names remembered as not found
+} PathCacheStats;
+
+// returns the full path of a command name, or NULL if it is not in any of
+// the search directories. The string belongs to the cache and stays valid
+// until path_cache_clear().
+const char *path_cache_lookup(const char *name);
+
+// resolves name now and remembers the result, returns 0 if it was found.
+// A path it replaces is kept until path_cache_clear().
+int path_cache_seed(const char *name);
+
+// forgets every remembered name, the counters are kept
+void path_cache_clear(void);
+
+// writes "hits<TAB>path" for every command found so far
+void path_cache_print(int fd);
+
+void path_cache_stats(PathCacheStats *stats);
+
+#endif
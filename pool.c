@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "pool.h"
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+  pid_t pid;
+  int pidfd; // readable once the child exits, -1 if we have none
+  int index;
+  int out_fd;
+  int err_fd;
+} Running;
+
+int pool_default_jobs(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (int)cores : 1;
+}
+
+// an anonymous file a task's output collects in. Unlike a pipe it never
+// fills up, so the task doesn't wait on us while it runs.
+static int capture_fd(void) {
+  int fd = memfd_create("mysh-output", MFD_CLOEXEC);
+  if (fd < 0) {
+    char path[] = "/tmp/mysh-XXXXXX";
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0) {
+      unlink(path);
+    }
+  }
+  return fd;
+}
+
+// copies everything in from to the descriptor to
+static void emit(int from, int to) {
+  off_t size = lseek(from, 0, SEEK_END);
+  off_t offset = 0;
+  while (offset < size) {
+    ssize_t n = sendfile(to, from, &offset, size - offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+  }
+
+  // sendfile() can't write to everything, copy the rest by hand
+  char buffer[65536];
+  while (offset < size) {
+    ssize_t n = pread(from, buffer, sizeof(buffer), offset);
+    if (n <= 0) {
+      break;
+    }
+    for (ssize_t done = 0; done < n;) {
+      ssize_t written = write(to, buffer + done, n - done);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return;
+      }
+      done += written;
+    }
+    offset += n;
+  }
+}
+
+static pid_t start(PoolTask task, void *arg, int index, int out_fd,
+                   int err_fd) {
+  // anything still buffered has to come out before the task's output
+  output_flush();
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+
+  int null_fd = open("/dev/null", O_RDONLY);
+  if (null_fd >= 0) {
+    dup2(null_fd, STDIN_FILENO);
+    close(null_fd);
+  }
+  dup2(out_fd, STDOUT_FILENO);
+  dup2(err_fd, STDERR_FILENO);
+  output_init();
+  int status = task(arg, index);
+  exit(status);
+}
+
+// waits for one of the running tasks, returns its slot or -1. Each child
+// is waited on by pid, so we never reap a child someone else started.
+static int wait_any(Running *running, struct pollfd *fds, int active,
+                    int *status) {
+  int have_pidfds = 1;
+  for (int i = 0; i < active; i++) {
+    if (running[i].pidfd < 0) {
+      have_pidfds = 0;
+    }
+    fds[i].fd = running[i].pidfd;
+    fds[i].events = POLLIN;
+  }
+
+  while (1) {
+    if (!have_pidfds) {
+      // no pidfds on this kernel. waitpid(-1) would also reap the shell's
+      // own & jobs, so look at our children one by one and nap in between.
+      for (int i = 0; i < active; i++) {
+        pid_t pid = waitpid(running[i].pid, status, WNOHANG);
+        if (pid == running[i].pid) {
+          return i;
+        }
+        if (pid < 0 && errno != EINTR) {
+          return -1;
+        }
+      }
+      poll(NULL, 0, 10);
+      continue;
+    }
+
+    if (poll(fds, active, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    for (int i = 0; i < active; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      pid_t pid;
+      do {
+        pid = waitpid(running[i].pid, status, 0);
+      } while (pid < 0 && errno == EINTR);
+      return pid < 0 ? -1 : i;
+    }
+  }
+}
+
+int pool_run(int jobs, int num_tasks, PoolTask task, void *arg, int *statuses) {
+  if (jobs < 1) {
+    jobs = 1;
+  }
+  if (jobs > num_tasks) {
+    jobs = num_tasks;
+  }
+  if (num_tasks <= 0) {
+    return 0;
+  }
+  Running *running = malloc(jobs * sizeof(Running));
+  struct pollfd *fds = malloc(jobs * sizeof(struct pollfd));
+  if (running == NULL || fds == NULL) {
+    perror("mysh");
+    free(running);
+    free(fds);
+    return num_tasks;
+  }
+
+  int next = 0, active = 0, failed = 0;
+  while (next < num_tasks || active > 0) {
+    while (next < num_tasks && active < jobs) {
+      Running *slot = &running[active];
+      int index = next++;
+      statuses[index] = -1;
+      slot->index = index;
+      slot->out_fd = capture_fd();
+      slot->err_fd = capture_fd();
+      slot->pid = -1;
+      if (slot->out_fd >= 0 && slot->err_fd >= 0) {
+        slot->pid = start(task, arg, index, slot->out_fd, slot->err_fd);
+      }
+      if (slot->pid < 0) {
+        perror("mysh");
+        if (slot->out_fd >= 0) {
+          close(slot->out_fd);
+        }
+        if (slot->err_fd >= 0) {
+          close(slot->err_fd);
+        }
+        failed++;
+        continue;
+      }
+      slot->pidfd = syscall(SYS_pidfd_open, slot->pid, 0);
+      active++;
+    }
+    if (active == 0) {
+      break;
+    }
+
+    int status;
+    int done = wait_any(running, fds, active, &status);
+    if (done < 0) {
+      perror("waitpid");
+      break;
+    }
+
+    Running *slot = &running[done];
+    statuses[slot->index] = status;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      failed++;
+    }
+    output_flush();
+    fflush(stderr);
+    emit(slot->out_fd, STDOUT_FILENO);
+    emit(slot->err_fd, STDERR_FILENO);
+    close(slot->out_fd);
+    close(slot->err_fd);
+    if (slot->pidfd >= 0) {
+      close(slot->pidfd);
+    }
+    running[done] = running[--active];
+  }
+
+  // only reached early if waiting failed, count what is left as failed
+  failed += active + (num_tasks - next);
+  for (int i = 0; i < active; i++) {
+    close(running[i].out_fd);
+    close(running[i].err_fd);
+    if (running[i].pidfd >= 0) {
+      close(running[i].pidfd);
+    }
+  }
+  free(running);
+  free(fds);
+  return failed;
+}
@@ -0,0 +1,19 @@
+#ifndef POOL_H
+#define POOL_H
+
+// a task runs in its own forked child, its return value is the child's
+// exit status
+typedef int (*PoolTask)(void *arg, int index);
+
+// runs task(arg, i) for every i below num_tasks, at most jobs at a time.
+// What a task writes to stdout and stderr is captured and copied to our
+// stdout and stderr in one piece when it finishes, so the output of two
+// tasks never interleaves. Tasks start with stdin on /dev/null.
+// statuses[i] gets the wait status of task i, or -1 if it couldn't be
+// started. Returns the number of tasks that didn't exit with 0.
+int pool_run(int jobs, int num_tasks, PoolTask task, void *arg, int *statuses);
+
+// how many tasks the machine can run at once
+int pool_default_jobs(void);
+
+#endif
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "ring.h"
+#include "output.h"
+#include "trace.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_SIZE (64 * 1024) // same as a pipe, must be a power of two
+#define CACHE_LINE 64
+
+/*
+head and tail count every byte ever written and read, so head - tail is
+what's buffered and neither side ever has to tell full from empty. Only
+the writer stores head and only the reader stores tail, which makes the
+data path plain loads and stores.
+
+A side that can't go on sleeps on a futex word the other side bumps. It
+says so in its waiting flag first, and the other side only makes the wake
+syscall when the flag is up. Both sides store, fence, then load the
+other's value, so one of them always sees the other.
+*/
+struct Ring {
+  // written by the writer
+  size_t head;
+  uint32_t data_seq; // bumped when there is data, or the writer closed
+  int writer_waiting;
+  int writer_closed;
+  char pad1[CACHE_LINE];
+
+  // written by the reader
+  size_t tail;
+  uint32_t space_seq; // bumped when there is room, or the reader closed
+  int reader_waiting;
+  int reader_closed;
+  char pad2[CACHE_LINE];
+
+  int refs;
+  int trace_stage; // the writing stage, for MYSH_TRACE, or -1
+  char buf[RING_SIZE];
+};
+
+Ring *ring_create(void) {
+  void *memory;
+  if (posix_memalign(&memory, CACHE_LINE, sizeof(Ring)) != 0) {
+    return NULL;
+  }
+  Ring *ring = memory;
+  memset(ring, 0, offsetof(Ring, buf));
+  ring->refs = 2;
+  ring->trace_stage = -1;
+  return ring;
+}
+
+void ring_trace(Ring *ring, int stage) { ring->trace_stage = stage; }
+
+static void futex_wait(uint32_t *word, uint32_t value) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+// wakes the other side if it said it is waiting
+static void notify(uint32_t *seq, int *waiting) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+    __atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+ssize_t ring_write(Ring *ring, const void *data, size_t len) {
+  const char *from = data;
+  size_t done = 0;
+  while (done < len) {
+    if (__atomic_load_n(&ring->reader_closed, __ATOMIC_ACQUIRE)) {
+      errno = EPIPE;
+      return -1;
+    }
+    size_t head = ring->head;
+    size_t room = RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+    if (room == 0) {
+      uint32_t seq = __atomic_load_n(&ring->space_seq, __ATOMIC_SEQ_CST);
+      __atomic_store_n(&ring->writer_waiting, 1, __ATOMIC_SEQ_CST);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head - RING_SIZE &&
+          !__atomic_load_n(&ring->reader_closed, __ATOMIC_ACQUIRE)) {
+        futex_wait(&ring->space_seq, seq);
+      }
+      __atomic_store_n(&ring->writer_waiting, 0, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if (head == 0 && ring->trace_stage >= 0) {
+      trace_event("first_byte", "\"stage\":%d,\"via\":\"ring\"", ring->trace_stage);
+    }
+    size_t n = len - done < room ? len - done : room;
+    size_t at = head & (RING_SIZE - 1);
+    size_t first = RING_SIZE - at < n ? RING_SIZE - at : n;
+    memcpy(ring->buf + at, from + done, first);
+    memcpy(ring->buf, from + done + first, n - first);
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    notify(&ring->data_seq, &ring->reader_waiting);
+    done += n;
+  }
+  return done;
+}
+
+ssize_t ring_read(Ring *ring, void *buf, size_t len) {
+  size_t tail = ring->tail;
+  for (;;) {
+    size_t ready = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    if (ready > 0) {
+      size_t n = len < ready ? len : ready;
+      size_t at = tail & (RING_SIZE - 1);
+      size_t first = RING_SIZE - at < n ? RING_SIZE - at : n;
+      memcpy(buf, ring->buf + at, first);
+      memcpy((char *)buf + first, ring->buf, n - first);
+      __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+      notify(&ring->space_seq, &ring->writer_waiting);
+      return n;
+    }
+    if (len == 0) {
+      return 0;
+    }
+    // the writer stores head before it closes, so this sees the last bytes
+    if (__atomic_load_n(&ring->writer_closed, __ATOMIC_ACQUIRE)) {
+      if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return 0;
+      }
+      continue;
+    }
+    uint32_t seq = __atomic_load_n(&ring->data_seq, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ring->reader_waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail &&
+        !__atomic_load_n(&ring->writer_closed, __ATOMIC_ACQUIRE)) {
+      futex_wait(&ring->data_seq, seq);
+    }
+    __atomic_store_n(&ring->reader_waiting, 0, __ATOMIC_RELAXED);
+  }
+}
+
+static void release(Ring *ring) {
+  if (__atomic_sub_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(ring);
+  }
+}
+
+// closing always wakes the other side, it has to see the flag
+static void close_end(Ring *ring, int *closed, uint32_t *seq) {
+  __atomic_store_n(closed, 1, __ATOMIC_RELEASE);
+  __atomic_fetch_add(seq, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  release(ring);
+}
+
+void ring_close_writer(Ring *ring) {
+  close_end(ring, &ring->writer_closed, &ring->data_seq);
+}
+
+void ring_close_reader(Ring *ring) {
+  close_end(ring, &ring->reader_closed, &ring->space_seq);
+}
+
+ssize_t stream_read(Stream *stream, void *buf, size_t len) {
+  if (stream->ring != NULL) {
+    return ring_read(stream->ring, buf, len);
+  }
+  for (;;) {
+    ssize_t n = read(stream->fd, buf, len);
+    if (n >= 0 || errno != EINTR) {
+      return n;
+    }
+  }
+}
+
+ssize_t stream_write(Stream *stream, const void *data, size_t len) {
+  if (stream->ring != NULL) {
+    return ring_write(stream->ring, data, len);
+  }
+  if (stream->buffered) {
+    return output_write(stream->fd, data, len);
+  }
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(stream->fd, (const char *)data + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return done;
+}
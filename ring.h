@@ -0,0 +1,40 @@
+#ifndef RING_H
+#define RING_H
+
+#include <sys/types.h>
+
+// A byte pipe between two threads of the shell: one writer, one reader, no
+// locks. Only a side that has to wait makes a syscall (a futex), so a full
+// pipeline of builtins can run without touching the kernel per write.
+typedef struct Ring Ring;
+
+Ring *ring_create(void);
+
+// writes all of data, waiting for room. -1 with EPIPE once the reader is gone
+ssize_t ring_write(Ring *ring, const void *data, size_t len);
+
+// waits for at least one byte, 0 once the writer is gone and it's empty
+ssize_t ring_read(Ring *ring, void *buf, size_t len);
+
+// makes the first write into the ring a first_byte trace event of stage
+void ring_trace(Ring *ring, int stage);
+
+// each side closes its end once, the ring is freed after both did
+void ring_close_writer(Ring *ring);
+void ring_close_reader(Ring *ring);
+
+// where a builtin reads or writes: a ring when it is set, otherwise fd.
+// Writes to a buffered fd go through output_write()
+typedef struct {
+  int fd;
+  Ring *ring;
+  int buffered;
+} Stream;
+
+// like read(), EINTR is retried
+ssize_t stream_read(Stream *stream, void *buf, size_t len);
+
+// writes everything or returns -1
+ssize_t stream_write(Stream *stream, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,465 @@
+#define _DEFAULT_SOURCE
+#include "script_cache.h"
+#include "hash.h"
+#include "line_reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "MYSHSC\r\n"
+#define CACHE_VERSION 5
+
+#define SCRIPT_LINE_EMPTY UINT64_MAX         // parse() gave NULL
+#define SCRIPT_LINE_TOO_LONG (UINT64_MAX - 1)
+
+#define FLAG_AND 1
+#define FLAG_OR 2
+#define FLAG_INPUT 4
+#define FLAG_OUTPUT 8
+#define FLAG_BACKGROUND 16
+#define FLAG_TIMED 32
+#define FLAG_TIME_VERBOSE 64
+#define FLAG_INPUT_TEXT 128
+#define FLAG_HERE_STRING 256
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size; // catches a header laid out by a different build
+  uint64_t script_size;
+  uint64_t script_hash[2];
+  uint64_t max_line;
+  uint64_t num_lines;
+  uint64_t payload_size; // index and records
+  uint64_t payload_hash[2];
+} CacheHeader;
+
+// growable byte buffer the cache file is built in
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+static int buffer_reserve(Buffer *buffer, size_t more) {
+  if (buffer->capacity - buffer->size >= more) {
+    return 0;
+  }
+  size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+  while (capacity - buffer->size < more) {
+    capacity *= 2;
+  }
+  char *data = realloc(buffer->data, capacity);
+  if (data == NULL) {
+    return -1;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+static int buffer_append(Buffer *buffer, const void *bytes, size_t len) {
+  if (buffer_reserve(buffer, len) != 0) {
+    return -1;
+  }
+  memcpy(buffer->data + buffer->size, bytes, len);
+  buffer->size += len;
+  return 0;
+}
+
+static int put_u32(Buffer *buffer, uint32_t value) {
+  return buffer_append(buffer, &value, sizeof(value));
+}
+
+static int put_bytes(Buffer *buffer, const char *str, uint32_t len) {
+  size_t padded = ((size_t)len + 1 + 3) & ~(size_t)3;
+  if (put_u32(buffer, len) != 0 || buffer_reserve(buffer, padded) != 0) {
+    return -1;
+  }
+  memcpy(buffer->data + buffer->size, str, len);
+  memset(buffer->data + buffer->size + len, 0, padded - len);
+  buffer->size += padded;
+  return 0;
+}
+
+static int put_string(Buffer *buffer, const char *str) {
+  return put_bytes(buffer, str, strlen(str));
+}
+
+static int put_record(Buffer *buffer, const ParsedCmd *cmd) {
+  uint32_t flags = (cmd->is_and ? FLAG_AND : 0) | (cmd->is_or ? FLAG_OR : 0) |
+                   (cmd->input_file ? FLAG_INPUT : 0) |
+                   (cmd->input_text ? FLAG_INPUT_TEXT : 0) |
+                   (cmd->is_here_string ? FLAG_HERE_STRING : 0) |
+                   (cmd->output_file ? FLAG_OUTPUT : 0) |
+                   (cmd->is_background ? FLAG_BACKGROUND : 0) |
+                   (cmd->is_timed ? FLAG_TIMED : 0) |
+                   (cmd->is_timed == 2 ? FLAG_TIME_VERBOSE : 0);
+  if (put_u32(buffer, flags) != 0 || put_u32(buffer, cmd->num_commands) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < cmd->num_commands; i++) {
+    if (put_u32(buffer, cmd->commands[i].num_args) != 0) {
+      return -1;
+    }
+    for (int j = 0; j < cmd->commands[i].num_args; j++) {
+      if (put_string(buffer, cmd->commands[i].args[j]) != 0) {
+        return -1;
+      }
+    }
+  }
+  if (cmd->input_file && put_string(buffer, cmd->input_file) != 0) {
+    return -1;
+  }
+  if (cmd->input_text &&
+      (cmd->input_text_len > UINT32_MAX - 4 ||
+       put_bytes(buffer, cmd->input_text, cmd->input_text_len) != 0)) {
+    return -1;
+  }
+  if (cmd->output_file && put_string(buffer, cmd->output_file) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// NextLine over the LineReader compile() splits the script with
+static int next_body_line(void *lines, const char **line, size_t *length) {
+  return line_reader_next(lines, line, length);
+}
+
+// parses every line of script into a complete cache file in out. Lines are
+// split by a LineReader over the script so they come out exactly as they
+// would when running it directly. The body of a << is kept in its line's
+// record, and its lines and delimiter become empty lines.
+static int compile(Buffer *out, const char *script, size_t size,
+                   size_t max_line, const uint64_t script_hash[2]) {
+  Buffer index = {0}, records = {0};
+  Arena scratch;
+  arena_init(&scratch, 4096);
+
+  LineReader lines;
+  line_reader_init(&lines, -1, 0, max_line);
+  lines.map = script;
+  lines.map_size = size;
+
+  int result = -1;
+  uint64_t num_lines = 0;
+  const char *line;
+  size_t line_len;
+  int got;
+  while ((got = line_reader_next(&lines, &line, &line_len)) != LINE_EOF) {
+    uint64_t offset = SCRIPT_LINE_TOO_LONG;
+    long line_number = lines.line_number;
+    if (got == LINE_OK) {
+      ParsedCmd *cmd = parse_line(line, line_len, &scratch);
+      offset = SCRIPT_LINE_EMPTY;
+      if (cmd != NULL && cmd->here_doc_end != NULL) {
+        int body = parse_here_doc(cmd, next_body_line, &lines, &scratch);
+        if (body == LINE_TOO_LONG) {
+          // the line can't run without all of its body
+          offset = SCRIPT_LINE_TOO_LONG;
+          cmd = NULL;
+        } else if (body != 0) {
+          goto done;
+        }
+      }
+      if (cmd != NULL) {
+        offset = records.size;
+        if (put_record(&records, cmd) != 0) {
+          goto done;
+        }
+      }
+      arena_reset(&scratch);
+    }
+    if (buffer_append(&index, &offset, sizeof(offset)) != 0) {
+      goto done;
+    }
+    num_lines++;
+    // the lines a << took run as blank lines
+    for (offset = SCRIPT_LINE_EMPTY; line_number < lines.line_number;
+         line_number++) {
+      if (buffer_append(&index, &offset, sizeof(offset)) != 0) {
+        goto done;
+      }
+      num_lines++;
+    }
+  }
+
+  CacheHeader header = {0};
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.header_size = sizeof(CacheHeader);
+  header.script_size = size;
+  memcpy(header.script_hash, script_hash, sizeof(header.script_hash));
+  header.max_line = max_line;
+  header.num_lines = num_lines;
+  header.payload_size = index.size + records.size;
+
+  Hasher hasher;
+  hasher_init(&hasher);
+  hasher_update(&hasher, index.data, index.size);
+  hasher_update(&hasher, records.data, records.size);
+  hasher_final(&hasher, header.payload_hash);
+
+  if (buffer_reserve(out, sizeof(header) + header.payload_size) != 0) {
+    goto done;
+  }
+  buffer_append(out, &header, sizeof(header));
+  buffer_append(out, index.data, index.size);
+  buffer_append(out, records.data, records.size);
+  result = 0;
+
+done:
+  free(index.data);
+  free(records.data);
+  arena_free(&scratch);
+  return result;
+}
+
+// checks a cache file belongs to this script and hasn't been damaged, then
+// points compiled into it
+static int attach(CompiledScript *compiled, const char *data, size_t size,
+                  size_t script_size, const uint64_t script_hash[2],
+                  size_t max_line) {
+  if (size < sizeof(CacheHeader)) {
+    return -1;
+  }
+  CacheHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CACHE_VERSION ||
+      header.header_size != sizeof(CacheHeader) ||
+      header.script_size != script_size ||
+      memcmp(header.script_hash, script_hash, sizeof(header.script_hash)) != 0 ||
+      header.max_line != max_line ||
+      header.payload_size != size - sizeof(CacheHeader) ||
+      header.num_lines > header.payload_size / sizeof(uint64_t)) {
+    return -1;
+  }
+
+  uint64_t payload_hash[2];
+  hash_bytes(data + sizeof(CacheHeader), header.payload_size, payload_hash);
+  if (memcmp(header.payload_hash, payload_hash, sizeof(payload_hash)) != 0) {
+    return -1;
+  }
+
+  size_t index_size = header.num_lines * sizeof(uint64_t);
+  compiled->data = data;
+  compiled->size = size;
+  compiled->num_lines = header.num_lines;
+  compiled->index = (const uint64_t *)(data + sizeof(CacheHeader));
+  compiled->records = data + sizeof(CacheHeader) + index_size;
+  compiled->records_size = header.payload_size - index_size;
+  return 0;
+}
+
+// maps an existing cache file, returns 0 if it is good to use
+static int load(CompiledScript *compiled, const char *path, size_t script_size,
+                const uint64_t script_hash[2], size_t max_line) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  if (attach(compiled, map, st.st_size, script_size, script_hash, max_line) !=
+      0) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  compiled->mapped = 1;
+  return 0;
+}
+
+// writes the cache file under a temporary name and renames it into place,
+// so a concurrent run never maps a half-written file
+static void store(const char *path, const Buffer *buffer) {
+  char tmp_path[4096];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  size_t written = 0;
+  while (written < buffer->size) {
+    ssize_t n = write(fd, buffer->data + written, buffer->size - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+  if (close(fd) != 0 || written != buffer->size ||
+      rename(tmp_path, path) != 0) {
+    unlink(tmp_path);
+  }
+}
+
+int script_cache_open(CompiledScript *compiled, const char *cache_dir,
+                      const char *script, size_t size, size_t max_line) {
+  memset(compiled, 0, sizeof(*compiled));
+
+  uint64_t script_hash[2];
+  char hex[33];
+  hash_bytes(script, size, script_hash);
+  hash_to_hex(script_hash, hex);
+
+  char path[4096];
+  int path_len = snprintf(path, sizeof(path), "%s/%s.msc", cache_dir, hex);
+  int have_path = path_len > 0 && path_len < (int)sizeof(path) - 32;
+
+  if (have_path && load(compiled, path, size, script_hash, max_line) == 0) {
+    return 0;
+  }
+
+  // missing, stale or damaged: compile it again and keep it in memory
+  Buffer buffer = {0};
+  if (compile(&buffer, script, size, max_line, script_hash) != 0 ||
+      attach(compiled, buffer.data, buffer.size, size, script_hash,
+             max_line) != 0) {
+    free(buffer.data);
+    memset(compiled, 0, sizeof(*compiled));
+    return -1;
+  }
+  compiled->mapped = 0;
+
+  if (have_path) {
+    mkdir(cache_dir, 0755);
+    store(path, &buffer);
+  }
+  return 0;
+}
+
+// reads a string written by put_string() or put_bytes(), NULL if it runs
+// off the end. length, if not NULL, gets its length.
+static char *get_string(const CompiledScript *compiled, size_t *offset,
+                        size_t *length) {
+  uint32_t len;
+  if (compiled->records_size - *offset < sizeof(len)) {
+    return NULL;
+  }
+  memcpy(&len, compiled->records + *offset, sizeof(len));
+  *offset += sizeof(len);
+  size_t padded = ((size_t)len + 1 + 3) & ~(size_t)3;
+  if (compiled->records_size - *offset < padded) {
+    return NULL;
+  }
+  char *str = (char *)compiled->records + *offset;
+  *offset += padded;
+  if (length != NULL) {
+    *length = len;
+  }
+  return str;
+}
+
+static int get_u32(const CompiledScript *compiled, size_t *offset,
+                   uint32_t *value) {
+  if (compiled->records_size - *offset < sizeof(*value)) {
+    return -1;
+  }
+  memcpy(value, compiled->records + *offset, sizeof(*value));
+  *offset += sizeof(*value);
+  return 0;
+}
+
+int script_cache_line(const CompiledScript *compiled, long index,
+                      Arena *arena, ParsedCmd **cmd) {
+  *cmd = NULL;
+  uint64_t record = compiled->index[index];
+  if (record == SCRIPT_LINE_TOO_LONG) {
+    return LINE_TOO_LONG;
+  }
+  if (record == SCRIPT_LINE_EMPTY || record >= compiled->records_size) {
+    return LINE_OK;
+  }
+
+  size_t offset = record;
+  uint32_t flags, num_commands;
+  if (get_u32(compiled, &offset, &flags) != 0 ||
+      get_u32(compiled, &offset, &num_commands) != 0 ||
+      num_commands > compiled->records_size) {
+    return LINE_OK;
+  }
+
+  ParsedCmd *parsed = arena_alloc(arena, sizeof(ParsedCmd));
+  Command *commands = arena_alloc(arena, num_commands * sizeof(Command));
+  if (parsed == NULL || (num_commands > 0 && commands == NULL)) {
+    return LINE_OK;
+  }
+
+  for (uint32_t i = 0; i < num_commands; i++) {
+    uint32_t num_args;
+    if (get_u32(compiled, &offset, &num_args) != 0 ||
+        num_args > compiled->records_size) {
+      return LINE_OK;
+    }
+    char **args = arena_alloc(arena, (num_args + 1) * sizeof(char *));
+    if (args == NULL) {
+      return LINE_OK;
+    }
+    for (uint32_t j = 0; j < num_args; j++) {
+      if ((args[j] = get_string(compiled, &offset, NULL)) == NULL) {
+        return LINE_OK;
+      }
+    }
+    args[num_args] = NULL;
+    commands[i].args = args;
+    commands[i].num_args = num_args;
+  }
+
+  parsed->commands = commands;
+  parsed->num_commands = num_commands;
+  parsed->input_file = NULL;
+  parsed->output_file = NULL;
+  parsed->input_text = NULL;
+  parsed->input_text_len = 0;
+  parsed->is_here_string = (flags & FLAG_HERE_STRING) != 0;
+  parsed->here_doc_end = NULL;
+  if ((flags & FLAG_INPUT) &&
+      (parsed->input_file = get_string(compiled, &offset, NULL)) == NULL) {
+    return LINE_OK;
+  }
+  if ((flags & FLAG_INPUT_TEXT) &&
+      (parsed->input_text = get_string(compiled, &offset,
+                                       &parsed->input_text_len)) == NULL) {
+    return LINE_OK;
+  }
+  if ((flags & FLAG_OUTPUT) &&
+      (parsed->output_file = get_string(compiled, &offset, NULL)) == NULL) {
+    return LINE_OK;
+  }
+  parsed->is_and = (flags & FLAG_AND) != 0;
+  parsed->is_or = (flags & FLAG_OR) != 0;
+  parsed->is_background = (flags & FLAG_BACKGROUND) != 0;
+  parsed->is_timed = (flags & FLAG_TIME_VERBOSE) ? 2 : (flags & FLAG_TIMED) != 0;
+
+  *cmd = parsed;
+  return LINE_OK;
+}
+
+void script_cache_close(CompiledScript *compiled) {
+  if (compiled->data == NULL) {
+    return;
+  }
+  if (compiled->mapped) {
+    munmap((void *)compiled->data, compiled->size);
+  } else {
+    free((void *)compiled->data);
+  }
+  memset(compiled, 0, sizeof(*compiled));
+}
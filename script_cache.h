@@ -0,0 +1,48 @@
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include "arena.h"
+#include "parser.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// A script compiled ahead of time: every line already tokenized and parsed
+// and written to MYSH_CACHE_DIR as <content hash>.msc. The file is mapped
+// straight back in on later runs, so they skip lexing altogether.
+//
+// Layout, all in host byte order:
+//   header      see CacheHeader in script_cache.c
+//   index       one uint64_t per line, the offset of its record or one of
+//               the SCRIPT_LINE_ markers below
+//   records     uint32_t flags, uint32_t num_commands, then per command a
+//               uint32_t num_args and its args, then the input file, the
+//               here-doc or here-string body and the output file if the
+//               flags say so. A string is a uint32_t length and the bytes
+//               with a '\0', padded to 4 bytes.
+typedef struct {
+  const char *data; // the whole cache file
+  size_t size;
+  int mapped;       // data is mmap()ed, otherwise malloc()ed
+  long num_lines;
+  const uint64_t *index;
+  const char *records;
+  size_t records_size;
+} CompiledScript;
+
+// opens the compiled form of the size bytes of script. A cache entry that
+// is missing, from another version, or doesn't match its checksum is
+// rebuilt from the script and written back. max_line is the reader's
+// limit, longer lines are remembered as too long. Returns 0 or -1 if the
+// script couldn't be compiled at all.
+int script_cache_open(CompiledScript *compiled, const char *cache_dir,
+                      const char *script, size_t size, size_t max_line);
+
+// rebuilds line index (from 0) in arena. Returns LINE_OK and sets cmd,
+// which is NULL for blank lines like parse() would give, or LINE_TOO_LONG.
+// The strings point into the cache and are read-only.
+int script_cache_line(const CompiledScript *compiled, long index,
+                      Arena *arena, ParsedCmd **cmd);
+
+void script_cache_close(CompiledScript *compiled);
+
+#endif
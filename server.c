@@ -0,0 +1,568 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "arena.h"
+#include "executor.h"
+#include "output.h"
+#include "parser.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_FDS 4                       // stdin, stdout, stderr, cwd
+#define MAX_SCRIPT (64 * 1024 * 1024)   // 64mb
+#define WARM_LINES 256                  // lines of a script looked up ahead
+#define RECEIVE_TIMEOUT 5000            // ms a client has to send it all
+
+// a request whose child is running
+typedef struct {
+  pid_t pid;
+  int pidfd; // readable once the child exits, -1 if we have none
+  int conn;
+} Running;
+
+// a connection whose request hasn't all come in yet. It is read a piece
+// at a time as it arrives, so a slow client holds up nobody but itself.
+typedef struct {
+  int conn;
+  int fds[NUM_FDS];
+  int got_header; // fds holds the client's descriptors then
+  ServeRequest request;
+  char *script;
+  size_t received;
+  long long deadline; // on the monotonic clock, in ms
+  short revents;
+} Pending;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static int make_address(const char *path, struct sockaddr_un *address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    fprintf(stderr, "mysh: socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(address->sun_path, path);
+  return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, (const char *)data + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+static int read_all(int fd, void *data, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = read(fd, (char *)data + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+// the socket we serve on. A socket file left by a server that is gone is
+// replaced, one that still answers is not.
+static int listen_on(const char *path) {
+  struct sockaddr_un address;
+  if (make_address(path, &address) != 0) {
+    return -1;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+      fprintf(stderr, "mysh: %s is already being served\n", path);
+      close(fd);
+      return -1;
+    }
+    unlink(path);
+  }
+  // only our user may connect, whoever does can run anything as us
+  mode_t old_mask = umask(077);
+  int bound = bind(fd, (struct sockaddr *)&address, sizeof(address));
+  umask(old_mask);
+  if (bound != 0 || listen(fd, SOMAXCONN) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static long long now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// reads what has come in of a request: the header with the client's
+// descriptors, then the script. 1 once it is all there, 0 while more has
+// to come, -1 for a bad request.
+static int receive(Pending *pending) {
+  if (!pending->got_header) {
+    char control[CMSG_SPACE(NUM_FDS * sizeof(int))];
+    struct iovec iov = {&pending->request, sizeof(pending->request)};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+      n = recvmsg(pending->conn, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+
+    int got_fds = 0;
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+      got_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      int kept = got_fds < NUM_FDS ? got_fds : NUM_FDS;
+      memcpy(pending->fds, CMSG_DATA(cmsg), kept * sizeof(int));
+      for (int i = NUM_FDS; i < got_fds; i++) {
+        int extra;
+        memcpy(&extra, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        close(extra);
+      }
+    }
+    if (got_fds != NUM_FDS || n != sizeof(pending->request) ||
+        (msg.msg_flags & MSG_CTRUNC) || pending->request.version != SERVE_VERSION ||
+        pending->request.length > MAX_SCRIPT) {
+      for (int i = 0; i < got_fds && i < NUM_FDS; i++) {
+        close(pending->fds[i]);
+      }
+      return -1;
+    }
+    pending->got_header = 1;
+    pending->script = malloc(pending->request.length + 1);
+    if (pending->script == NULL) {
+      return -1;
+    }
+  }
+
+  size_t length = pending->request.length;
+  while (pending->received < length) {
+    ssize_t n = recv(pending->conn, pending->script + pending->received,
+                     length - pending->received, MSG_DONTWAIT);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return 0;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    pending->received += n;
+  }
+  pending->script[length] = '\0';
+  return 1;
+}
+
+// forgets a request that never got to run, and the client's descriptors
+static void drop(Pending *pending) {
+  if (pending->got_header) {
+    for (int i = 0; i < NUM_FDS; i++) {
+      close(pending->fds[i]);
+    }
+  }
+  free(pending->script);
+  if (pending->conn >= 0) {
+    close(pending->conn);
+  }
+}
+
+// looks up the commands of the first lines, so the child finds them in
+// the cache and so do the requests after it
+static void warm(const char *script, size_t length, Arena *arena) {
+  const char *line = script;
+  const char *end = script + length;
+  for (int i = 0; i < WARM_LINES && line < end; i++) {
+    const char *newline = memchr(line, '\n', end - line);
+    size_t line_len = (newline != NULL ? newline : end) - line;
+    ParsedCmd *cmd = parse_line(line, line_len, arena);
+    for (int c = 0; cmd != NULL && c < cmd->num_commands; c++) {
+      char *name = cmd->commands[c].args[0];
+      if (strchr(name, '/') == NULL && find_builtin(name) == NULL) {
+        findFunction(name);
+      }
+    }
+    line += line_len + 1;
+    // a << body is text, not commands
+    if (cmd != NULL && cmd->here_doc_end != NULL) {
+      size_t end_len = strlen(cmd->here_doc_end);
+      while (line < end) {
+        newline = memchr(line, '\n', end - line);
+        line_len = (newline != NULL ? newline : end) - line;
+        int done = line_len == end_len && memcmp(line, cmd->here_doc_end, end_len) == 0;
+        line += line_len + 1;
+        if (done) {
+          break;
+        }
+      }
+    }
+    arena_reset(arena);
+  }
+}
+
+// the child of a request: becomes the client and runs its script
+static void run_request(char *script, size_t length, int fds[NUM_FDS],
+                        ServeScript run) {
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  for (int i = 0; i < 3; i++) {
+    if (dup2(fds[i], i) < 0) {
+      _exit(EXIT_FAILURE);
+    }
+  }
+  if (fchdir(fds[3]) != 0) {
+    perror("mysh: client directory");
+    _exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < NUM_FDS; i++) {
+    close(fds[i]);
+  }
+  output_init();
+
+  // a file, so the script is mapped and can be compiled like any other
+  int script_fd = memfd_create("mysh-script", MFD_CLOEXEC);
+  if (script_fd < 0 || write_all(script_fd, script, length) != 0 ||
+      lseek(script_fd, 0, SEEK_SET) != 0) {
+    perror("mysh");
+    _exit(EXIT_FAILURE);
+  }
+  free(script);
+  exit(run(script_fd));
+}
+
+// the status a client gets for a child's wait status
+static int exit_code(int status) {
+  if (WIFEXITED(status)) {
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status)) {
+    return 128 + WTERMSIG(status);
+  }
+  return EXIT_FAILURE;
+}
+
+// tells the client how its request went and forgets it
+static void finish(Running *request, int status) {
+  int code = exit_code(status);
+  TRACE("serve_done", "\"child\":%d,\"status\":%d", (int)request->pid, code);
+  // a client that went away doesn't get told
+  write_all(request->conn, &code, sizeof(code));
+  close(request->conn);
+  if (request->pidfd >= 0) {
+    close(request->pidfd);
+  }
+}
+
+// reaps whichever children are done, fds[i + 1] is the pidfd of running[i]
+static void reap(Running *running, int *active, struct pollfd *fds) {
+  for (int i = 0; i < *active; i++) {
+    int status;
+    if (running[i].pidfd >= 0 && !(fds[i + 1].revents & POLLIN)) {
+      continue;
+    }
+    pid_t pid = waitpid(running[i].pid, &status, WNOHANG);
+    if (pid != running[i].pid) {
+      continue;
+    }
+    finish(&running[i], status);
+    running[i] = running[--(*active)];
+    fds[i + 1] = fds[*active + 1];
+    i--;
+  }
+}
+
+// makes room for need elements of size bytes in *array
+static int reserve(void *array, int *cap, int need, size_t size) {
+  if (need <= *cap) {
+    return 0;
+  }
+  int new_cap = *cap > 0 ? *cap : 16;
+  while (new_cap < need) {
+    new_cap *= 2;
+  }
+  void *grown = realloc(*(void **)array, new_cap * size);
+  if (grown == NULL) {
+    return -1;
+  }
+  *(void **)array = grown;
+  *cap = new_cap;
+  return 0;
+}
+
+int serve(const char *path, ServeScript run) {
+  int listen_fd = listen_on(path);
+  if (listen_fd < 0) {
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = on_stop;
+  sigemptyset(&action.sa_mask);
+  // no SA_RESTART, poll() has to return for us to stop
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  // a client that hangs up before its status is written is not fatal
+  signal(SIGPIPE, SIG_IGN);
+
+  fprintf(stderr, "mysh: serving on %s\n", path);
+  Arena arena;
+  arena_init(&arena, 4096);
+  Running *running = NULL;
+  Pending *pending = NULL;
+  struct pollfd *fds = NULL;
+  int active = 0, cap = 0;
+  int waiting = 0, waiting_cap = 0;
+  int fds_cap = 0;
+  int result = EXIT_SUCCESS;
+
+  while (!stopping || active > 0) {
+    // every request waiting may start running in this round
+    if (reserve(&running, &cap, active + waiting + 1, sizeof(Running)) != 0 ||
+        reserve(&pending, &waiting_cap, waiting + 1, sizeof(Pending)) != 0 ||
+        reserve(&fds, &fds_cap, active + waiting + 1, sizeof(struct pollfd)) != 0) {
+      perror("mysh");
+      result = EXIT_FAILURE;
+      break;
+    }
+
+    // once we are stopping only the running requests are waited for, the
+    // listening socket and the running children's pidfds come first
+    fds[0].fd = stopping ? -1 : listen_fd;
+    fds[0].events = POLLIN;
+    int have_pidfds = 1;
+    for (int i = 0; i < active; i++) {
+      fds[i + 1].fd = running[i].pidfd;
+      fds[i + 1].events = POLLIN;
+      fds[i + 1].revents = 0;
+      if (running[i].pidfd < 0) {
+        have_pidfds = 0;
+      }
+    }
+    // without pidfds, children are checked for every so often
+    int timeout = have_pidfds ? -1 : 50;
+    long long now = now_ms();
+    for (int i = 0; i < waiting; i++) {
+      struct pollfd *fd = &fds[active + 1 + i];
+      fd->fd = pending[i].conn;
+      fd->events = POLLIN;
+      fd->revents = 0;
+      long long left = pending[i].deadline > now ? pending[i].deadline - now : 0;
+      if (timeout < 0 || left < timeout) {
+        timeout = (int)left;
+      }
+    }
+    int ready = poll(fds, active + waiting + 1, timeout);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      result = EXIT_FAILURE;
+      break;
+    }
+    // reaping moves the pollfds around
+    for (int i = 0; i < waiting; i++) {
+      pending[i].revents = fds[active + 1 + i].revents;
+    }
+    int can_accept = !stopping && (fds[0].revents & POLLIN);
+    reap(running, &active, fds);
+
+    now = now_ms();
+    for (int i = 0; i < waiting; i++) {
+      Pending *request = &pending[i];
+      int got = request->revents != 0 ? receive(request) : 0;
+      if (got == 0 && now < request->deadline && !stopping) {
+        continue;
+      }
+      if (got <= 0) {
+        if (got < 0) {
+          fprintf(stderr, "mysh: bad request\n");
+        } else if (!stopping) {
+          fprintf(stderr, "mysh: request timed out\n");
+        }
+        drop(request);
+        pending[i--] = pending[--waiting];
+        continue;
+      }
+      size_t length = request->request.length;
+      warm(request->script, length, &arena);
+
+      // anything still buffered would be written again by the child
+      fflush(stdout);
+      fflush(stderr);
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(listen_fd);
+        // the other clients' descriptors aren't this child's to hold open
+        for (int j = 0; j < waiting; j++) {
+          if (j != i) {
+            drop(&pending[j]);
+          }
+        }
+        for (int k = 0; k < active; k++) {
+          close(running[k].conn);
+          if (running[k].pidfd >= 0) {
+            close(running[k].pidfd);
+          }
+        }
+        run_request(request->script, length, request->fds, run);
+      }
+      int conn = request->conn;
+      request->conn = -1;
+      drop(request);
+      pending[i--] = pending[--waiting];
+      if (pid < 0) {
+        perror("fork");
+        int code = EXIT_FAILURE;
+        write_all(conn, &code, sizeof(code));
+        close(conn);
+        continue;
+      }
+      TRACE("serve_request", "\"child\":%d,\"bytes\":%zu", (int)pid, length);
+      Running *started = &running[active++];
+      started->pid = pid;
+      started->conn = conn;
+      started->pidfd = syscall(SYS_pidfd_open, pid, 0);
+    }
+    if (!can_accept) {
+      continue;
+    }
+
+    int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) {
+      if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+        perror("accept");
+      }
+      continue;
+    }
+    Pending *request = &pending[waiting++];
+    memset(request, 0, sizeof(*request));
+    request->conn = conn;
+    request->deadline = now + RECEIVE_TIMEOUT;
+  }
+
+  for (int i = 0; i < waiting; i++) {
+    drop(&pending[i]);
+  }
+  for (int i = 0; i < active; i++) {
+    close(running[i].conn);
+    if (running[i].pidfd >= 0) {
+      close(running[i].pidfd);
+    }
+  }
+  free(running);
+  free(pending);
+  free(fds);
+  arena_free(&arena);
+  close(listen_fd);
+  unlink(path);
+  return result;
+}
+
+int serve_client(const char *path, const char *script, size_t length) {
+  struct sockaddr_un address;
+  if (make_address(path, &address) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (length > MAX_SCRIPT) {
+    fprintf(stderr, "mysh: script is too long to send\n");
+    return EXIT_FAILURE;
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    perror(path);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (cwd < 0) {
+    perror("mysh: working directory");
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  ServeRequest request = {SERVE_VERSION, (unsigned int)length};
+  int fds[NUM_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, cwd};
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  struct iovec iov = {&request, sizeof(request)};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  // a server that goes away is reported, not a SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  close(cwd);
+  int code;
+  if (sent != sizeof(request) || write_all(fd, script, length) != 0 ||
+      read_all(fd, &code, sizeof(code)) != 0) {
+    fprintf(stderr, "mysh: %s: lost the server\n", path);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  return code;
+}
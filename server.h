@@ -0,0 +1,46 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+/*
+mysh --serve path keeps one shell running behind a Unix socket, so a
+service can run command lines without starting a shell for each.
+
+A client connects and sends a ServeRequest with its stdin, stdout, stderr
+and working directory attached as SCM_RIGHTS descriptors, then length
+bytes of script: one command line or a whole script. The server forks a
+child per request, which takes over those descriptors and runs the script
+like mysh would run a script file. When it is done the server writes its
+exit status back as a 4 byte int and closes the connection.
+
+Children start from the server, so they get its path cache without
+looking anything up again. The server looks up the commands of every
+script it is sent before it forks, so the cache stays warm for the
+requests after it too. Many requests run at the same time, and requests
+are read as they come in, next to each other, so a client that is slow to
+send holds up nobody else. One that hasn't all arrived after 5 seconds is
+dropped.
+*/
+
+#define SERVE_VERSION 1
+
+typedef struct {
+  unsigned int version; // SERVE_VERSION
+  unsigned int length;  // bytes of script that follow
+} ServeRequest;
+
+// runs a request's script, read from script_fd, with stdin, stdout,
+// stderr and the working directory already the client's. Returns the exit
+// status, it may also exit() the process.
+typedef int (*ServeScript)(int script_fd);
+
+// serves requests on a socket made at path until SIGINT or SIGTERM.
+// Returns EXIT_FAILURE if it couldn't start.
+int serve(const char *path, ServeScript run);
+
+// sends script to the server at path with our stdio and working directory
+// and returns the exit status it reports, or EXIT_FAILURE if it couldn't
+int serve_client(const char *path, const char *script, size_t length);
+
+#endif
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include "spawner.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static SpawnBackend backend = SPAWN_POSIX;
+static int backend_chosen = 0;
+
+/*
+The zygote is a child forked while the shell is still small, which then
+spends its life starting commands for it. The shell sends it a request on
+a SOCK_SEQPACKET socketpair: path and argv as one block of strings, with
+the command's stdin, stdout, stderr and working directory attached as
+SCM_RIGHTS descriptors. The zygote clone()s with CLONE_PARENT, so the new
+process is the shell's child and not the zygote's. The shell gets its
+SIGCHLD and waits for it with wait4() the same as for any other child,
+so exit statuses and rusage come back the usual way, whenever it exits.
+Copying the zygote costs the same however big the shell has grown. It
+replies with the pid or -errno.
+
+What the zygote starts is the child of whoever started the zygote, so
+only that process may use it. Forked children of the shell use
+posix_spawn, and so does a request that doesn't fit in one message.
+*/
+#define ZYGOTE_MESSAGE (64 * 1024)
+#define ZYGOTE_FDS 4 // stdin, stdout, stderr, working directory
+
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+static pid_t zygote_owner = -1; // the process the zygote starts commands for
+static pthread_mutex_t zygote_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the zygote's side: one request in, one clone(), one reply out
+static void zygote_serve(int sock) {
+  static char message[ZYGOTE_MESSAGE];
+  char **argv = NULL;
+  size_t argv_cap = 0;
+  for (;;) {
+    int fds[ZYGOTE_FDS];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {message, sizeof(message) - 1};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // the shell is gone
+      _exit(EXIT_SUCCESS);
+    }
+
+    int num_fds = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+      num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      if (num_fds > ZYGOTE_FDS) {
+        num_fds = ZYGOTE_FDS; // only the shell sends these, it sends 4
+      }
+      memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+    }
+
+    // path, then argv, each ending in '\0'
+    message[n] = '\0';
+    size_t argc = 0;
+    for (ssize_t i = 0; i < n; i++) {
+      argc += message[i] == '\0';
+    }
+    int reply = -EINVAL;
+    if (argc > argv_cap) {
+      char **grown = realloc(argv, argc * sizeof(char *));
+      if (grown != NULL) {
+        argv = grown;
+        argv_cap = argc;
+      } else {
+        reply = -ENOMEM;
+      }
+    }
+    if (num_fds == ZYGOTE_FDS && argc >= 2 && argc <= argv_cap &&
+        !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+      char *at = message + strlen(message) + 1;
+      for (size_t i = 0; i + 1 < argc; i++) {
+        argv[i] = at;
+        at += strlen(at) + 1;
+      }
+      argv[argc - 1] = NULL;
+
+      pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, NULL);
+      if (pid == 0) {
+        for (int i = 0; i < 3; i++) {
+          dup2(fds[i], i);
+        }
+        if (fchdir(fds[3]) != 0) {
+          perror("chdir");
+          _exit(EXIT_FAILURE);
+        }
+        execv(message, argv);
+        perror("execv");
+        _exit(EXIT_FAILURE);
+      }
+      reply = pid > 0 ? pid : -errno;
+    }
+    for (int i = 0; i < num_fds; i++) {
+      close(fds[i]);
+    }
+    while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0 && errno == EINTR) {
+    }
+  }
+}
+
+// forks the zygote, returns 0 if it is running
+static int start_zygote(void) {
+  if (zygote_fd >= 0 && zygote_owner == getpid()) {
+    return 0;
+  }
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+    return -1;
+  }
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    // keep nothing but stdio and the socket, a pipe end held here would
+    // keep a pipeline from ever seeing EOF
+    if (dup2(sv[1], 3) != 3 || fcntl(3, F_SETFD, FD_CLOEXEC) != 0) {
+      _exit(EXIT_FAILURE);
+    }
+    if (syscall(SYS_close_range, 4, ~0U, 0) != 0) {
+      for (int fd = 4; fd < 1024; fd++) {
+        close(fd);
+      }
+    }
+    zygote_serve(3);
+  }
+  close(sv[1]);
+  if (zygote_fd >= 0) {
+    // one inherited from the process that forked us
+    close(zygote_fd);
+  }
+  zygote_fd = sv[0];
+  zygote_pid = pid;
+  zygote_owner = getpid();
+  return 0;
+}
+
+// the zygote stopped answering, we stop asking
+static void lose_zygote(void) {
+  close(zygote_fd);
+  zygote_fd = -1;
+  waitpid(zygote_pid, NULL, WNOHANG);
+  zygote_pid = -1;
+}
+
+static pid_t spawn_posix(const char *path, char **argv, int in_fd, int out_fd);
+
+static pid_t spawn_zygote(const char *path, char **argv, int in_fd, int out_fd) {
+  static char message[ZYGOTE_MESSAGE];
+  pthread_mutex_lock(&zygote_lock);
+  if (zygote_fd < 0 || zygote_owner != getpid()) {
+    pthread_mutex_unlock(&zygote_lock);
+    return spawn_posix(path, argv, in_fd, out_fd);
+  }
+
+  size_t len = strlen(path) + 1;
+  int fits = len < sizeof(message);
+  if (fits) {
+    memcpy(message, path, len);
+  }
+  for (int i = 0; fits && argv[i] != NULL; i++) {
+    size_t arg_len = strlen(argv[i]) + 1;
+    fits = len + arg_len < sizeof(message);
+    if (fits) {
+      memcpy(message + len, argv[i], arg_len);
+      len += arg_len;
+    }
+  }
+  int cwd = fits ? open(".", O_PATH | O_DIRECTORY | O_CLOEXEC) : -1;
+  if (cwd < 0) {
+    pthread_mutex_unlock(&zygote_lock);
+    return spawn_posix(path, argv, in_fd, out_fd);
+  }
+
+  int fds[ZYGOTE_FDS] = {in_fd, out_fd, STDERR_FILENO, cwd};
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  struct iovec iov = {message, len};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t sent, got = -1;
+  int reply = 0;
+  do {
+    sent = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent == (ssize_t)len) {
+    do {
+      got = recv(zygote_fd, &reply, sizeof(reply), 0);
+    } while (got < 0 && errno == EINTR);
+  }
+  close(cwd);
+  if (got != sizeof(reply)) {
+    lose_zygote();
+    pthread_mutex_unlock(&zygote_lock);
+    return spawn_posix(path, argv, in_fd, out_fd);
+  }
+  pthread_mutex_unlock(&zygote_lock);
+  if (reply < 0) {
+    errno = -reply;
+    return -1;
+  }
+  return reply;
+}
+
+static void choose_backend(void) {
+  if (backend_chosen) {
+    return;
+  }
+  backend_chosen = 1;
+  const char *env = getenv("MYSH_SPAWN");
+  if (env != NULL && strcmp(env, "fork") == 0) {
+    backend = SPAWN_FORK;
+  } else if (env != NULL && strcmp(env, "zygote") == 0) {
+    spawner_set_backend(SPAWN_ZYGOTE);
+  }
+}
+
+void spawner_init(void) { choose_backend(); }
+
+void spawner_set_backend(SpawnBackend new_backend) {
+  backend_chosen = 1;
+  backend = new_backend;
+  if (backend == SPAWN_ZYGOTE && start_zygote() != 0) {
+    perror("mysh: zygote");
+    backend = SPAWN_POSIX;
+  }
+}
+
+SpawnBackend spawner_get_backend(void) {
+  choose_backend();
+  return backend;
+}
+
+// posix_spawn uses clone(CLONE_VM|CLONE_VFORK) in glibc, so the cost does not
+// grow with the size of our address space. The dup2 plan becomes file actions.
+static pid_t spawn_posix(const char *path, char **argv, int in_fd, int out_fd) {
+  posix_spawn_file_actions_t actions;
+  int err = posix_spawn_file_actions_init(&actions);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  if (in_fd != STDIN_FILENO) {
+    err = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+  }
+  if (err == 0 && out_fd != STDOUT_FILENO) {
+    err = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+  }
+
+  pid_t pid = -1;
+  if (err == 0) {
+    err = posix_spawn(&pid, path, &actions, NULL, argv, environ);
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return pid;
+}
+
+static pid_t spawn_fork(const char *path, char **argv, int in_fd, int out_fd) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  //child
+  if (in_fd != STDIN_FILENO) {
+    dup2(in_fd, STDIN_FILENO);
+  }
+  if (out_fd != STDOUT_FILENO) {
+    dup2(out_fd, STDOUT_FILENO);
+  }
+  if (trace_enabled) {
+    //the child's own event, written before exec takes the buffer away
+    trace_event("exec", NULL);
+    trace_flush();
+  }
+  execv(path, argv);
+  perror("execv");
+  _exit(EXIT_FAILURE);
+}
+
+/*
+Traced as spawn_start, then spawn once the child exists. posix_spawn only
+returns after the child has exec'd, so with it the exec event comes from
+here too. A forked child reports its own exec. The zygote replies before
+its child execs and nobody reports that exec.
+*/
+pid_t spawn_command(const char *path, char **argv, int in_fd, int out_fd) {
+  choose_backend();
+  char escaped[512];
+  if (trace_enabled) {
+    trace_event("spawn_start", "\"path\":\"%s\",\"backend\":\"%s\"",
+                trace_escape(path, escaped, sizeof(escaped)),
+                backend == SPAWN_FORK     ? "fork"
+                : backend == SPAWN_ZYGOTE ? "zygote"
+                                          : "posix_spawn");
+  }
+  pid_t pid;
+  if (backend == SPAWN_FORK) {
+    pid = spawn_fork(path, argv, in_fd, out_fd);
+  } else if (backend == SPAWN_ZYGOTE) {
+    pid = spawn_zygote(path, argv, in_fd, out_fd);
+  } else {
+    pid = spawn_posix(path, argv, in_fd, out_fd);
+  }
+  if (trace_enabled && pid > 0) {
+    trace_event("spawn", "\"child\":%d", (int)pid);
+    if (backend == SPAWN_POSIX) {
+      trace_event("exec", "\"child\":%d", (int)pid);
+    }
+  }
+  return pid;
+}
@@ -0,0 +1,26 @@
+#ifndef SPAWNER_H
+#define SPAWNER_H
+
+#include <sys/types.h>
+
+typedef enum {
+  SPAWN_POSIX, // posix_spawn, the child shares our memory until it execs
+  SPAWN_FORK,  // plain fork() + execv()
+  SPAWN_ZYGOTE // asks a small helper process started early to do it
+} SpawnBackend;
+
+// the backend starts out as SPAWN_POSIX, MYSH_SPAWN=fork picks SPAWN_FORK
+// and MYSH_SPAWN=zygote SPAWN_ZYGOTE. Picking SPAWN_ZYGOTE starts the zygote.
+void spawner_set_backend(SpawnBackend backend);
+SpawnBackend spawner_get_backend(void);
+
+// reads MYSH_SPAWN now. Called first thing in main(), so a zygote is
+// forked while the shell is still small.
+void spawner_init(void);
+
+// starts path with argv, reading from in_fd and writing to out_fd.
+// Every other descriptor the child should not see must be close-on-exec.
+// Returns the child's pid, or -1 with errno set if it could not be started.
+pid_t spawn_command(const char *path, char **argv, int in_fd, int out_fd);
+
+#endif
@@ -225,6 +225,17 @@ EOF
 
   echo "echo test | cat > output.txt" | $MYSH
   assert_file_contains "pipeline with output redirect" "output.txt" "test"
+
+  echo "seq 1 100000 | cat | wc -l" | timeout 10 $MYSH >output.txt 2>&1
+  assert_file_contains "pipeline larger than pipe buffer" "output.txt" "100000"
+
+  cat >script.sh <<'EOF'
+set -o pipefail
+false | true
+or echo pipefail_failed
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "set -o pipefail" "output.txt" "pipefail_failed"
 }
 
 test_conditionals_and() {
@@ -300,6 +311,537 @@ EOF
   assert_file_contains "batch mode output line 1" "output.txt" "line1"
   assert_file_contains "batch mode output line 2" "output.txt" "line2"
   assert_file_contains "batch mode output line 3" "output.txt" "line3"
+
+  # a script path that can't be mapped still goes through read()
+  $MYSH <(printf 'echo from_a_pipe\n') >output.txt 2>&1
+  assert_file_contains "script from a pipe" "output.txt" "from_a_pipe"
+
+  printf 'echo mapped_last_line' >script.sh
+  $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "mapped script without trailing newline" "output.txt" "mapped_last_line"
+}
+
+test_script_cache() {
+  echo -e "\n${YELLOW}=== Testing Script Cache ===${NC}"
+
+  cat >script.sh <<'EOF'
+# compiled once, loaded from the cache after that
+echo cached > cache_out.txt
+cat < cache_out.txt | tr a-z A-Z
+
+false
+and echo should_not_print
+or echo took_or
+EOF
+  $MYSH script.sh >expected.txt 2>&1
+
+  rm -rf cache
+  MYSH_CACHE_DIR=cache $MYSH script.sh >output.txt 2>&1
+  assert_equal "compiled script output" "$(cat expected.txt)" "$(cat output.txt)"
+  assert_equal "one cache entry written" "1" "$(ls cache | wc -l)"
+
+  entry=$(ls cache/*.msc)
+  cp "$entry" fresh.msc
+  MYSH_CACHE_DIR=cache $MYSH script.sh >output.txt 2>&1
+  assert_equal "script loaded from cache" "$(cat expected.txt)" "$(cat output.txt)"
+
+  # flip a byte past the header, the checksum catches it
+  printf 'X' | dd of="$entry" bs=1 seek=100 conv=notrunc 2>/dev/null
+  MYSH_CACHE_DIR=cache $MYSH script.sh >output.txt 2>&1
+  assert_equal "corrupt cache entry still runs" "$(cat expected.txt)" "$(cat output.txt)"
+  TOTAL=$((TOTAL + 1))
+  if cmp -s "$entry" fresh.msc; then
+    echo -e "${GREEN}PASS${NC}: corrupt cache entry is rebuilt"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: corrupt cache entry should be rebuilt"
+    FAIL=$((FAIL + 1))
+  fi
+
+  echo "echo changed" >>script.sh
+  MYSH_CACHE_DIR=cache $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "edited script gets a new entry" "output.txt" "changed"
+  assert_equal "two cache entries" "2" "$(ls cache | wc -l)"
+}
+
+test_jobs() {
+  echo -e "\n${YELLOW}=== Testing --jobs ===${NC}"
+
+  # both scripts write, sleep and write again, the output still comes out
+  # one script at a time
+  printf 'echo a1\nsleep 0.2\necho a2\n' >job_a.sh
+  printf 'echo b1\nsleep 0.1\necho b2\n' >job_b.sh
+  $MYSH --jobs 2 job_a.sh job_b.sh >output.txt 2>summary.txt
+  order=$(tr '\n' ' ' <output.txt | sed 's/ $//')
+  [ "$order" = "a1 a2 b1 b2" ] && order="b1 b2 a1 a2"
+  assert_equal "job output is not interleaved" "b1 b2 a1 a2" "$order"
+  assert_file_contains "job summary" "summary.txt" "2 scripts, 2 succeeded, 0 failed"
+
+  printf 'die broken\n' >job_fail.sh
+  $MYSH --jobs 2 job_a.sh job_fail.sh >output.txt 2>summary.txt
+  assert_equal "failed job fails mysh" "1" "$?"
+  assert_file_contains "failed job is named" "summary.txt" "job_fail.sh: exited with 1"
+  assert_file_contains "failed job summary" "summary.txt" "2 scripts, 1 succeeded, 1 failed"
+
+  # a script fails with its last line, like with sh
+  printf 'echo before\nfalse\n' >job_false.sh
+  $MYSH --jobs 2 job_a.sh job_false.sh >output.txt 2>summary.txt
+  assert_equal "script ending in false fails mysh" "1" "$?"
+  assert_file_contains "script ending in false is counted" "summary.txt" "2 scripts, 1 succeeded, 1 failed"
+  $MYSH job_false.sh >/dev/null 2>&1
+  assert_equal "script ending in false exits with 1" "1" "$?"
+
+  # cd in one script doesn't move the others
+  printf 'cd /\n' >job_cd.sh
+  printf 'sleep 0.1\npwd\n' >job_pwd.sh
+  $MYSH --jobs 2 job_cd.sh job_pwd.sh >output.txt 2>&1
+  assert_file_contains "jobs have their own directory" "output.txt" "$TEST_DIR"
+
+  rm -f job_false.sh
+  $MYSH --jobs 0 job_a.sh >output.txt 2>&1
+  assert_file_contains "invalid job count" "output.txt" "invalid job count"
+}
+
+test_background_jobs() {
+  echo -e "\n${YELLOW}=== Testing Background Jobs ===${NC}"
+
+  cat >script.sh <<'EOF'
+sleep 0.5 &
+sleep 0.5 &
+echo started
+wait
+echo joined
+EOF
+  start=$(date +%s%N)
+  $MYSH script.sh >output.txt 2>&1
+  elapsed=$((($(date +%s%N) - start) / 1000000))
+  assert_equal "background jobs then wait" "started joined" "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+  TOTAL=$((TOTAL + 1))
+  if [ "$elapsed" -lt 900 ]; then
+    echo -e "${GREEN}PASS${NC}: background jobs overlap (${elapsed}ms)"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: background jobs should overlap (${elapsed}ms)"
+    FAIL=$((FAIL + 1))
+  fi
+
+  cat >script.sh <<'EOF'
+pwd > bg_pwd.txt &
+cat missing_file | wc -l &
+wait -n
+wait -n
+wait %1
+or echo no_such_job
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "builtin in the background" "bg_pwd.txt" "$TEST_DIR"
+  assert_file_contains "wait for a missing job" "output.txt" "no such job"
+  assert_file_contains "failed wait feeds or" "output.txt" "no_such_job"
+
+  # a background job doesn't eat the rest of the script
+  printf 'cat &\nwait\necho still_here\n' | $MYSH >output.txt 2>&1
+  assert_file_contains "background stdin is /dev/null" "output.txt" "still_here"
+}
+
+test_parallel_block() {
+  echo -e "\n${YELLOW}=== Testing parallel { } ===${NC}"
+
+  cat >script.sh <<'EOF'
+echo before
+parallel {
+  sleep 0.5
+  sleep 0.5
+  sleep 0.5
+  # comments and blank lines are fine
+
+  seq 1 3
+}
+and echo after_ok
+EOF
+  start=$(date +%s%N)
+  MYSH_JOBS=4 $MYSH script.sh >output.txt 2>&1
+  elapsed=$((($(date +%s%N) - start) / 1000000))
+  assert_equal "parallel block output" "before 1 2 3 after_ok" "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+  TOTAL=$((TOTAL + 1))
+  if [ "$elapsed" -lt 1200 ]; then
+    echo -e "${GREEN}PASS${NC}: parallel block lines overlap (${elapsed}ms)"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: parallel block lines should overlap (${elapsed}ms)"
+    FAIL=$((FAIL + 1))
+  fi
+
+  # each line's output stays together
+  cat >script.sh <<'EOF'
+parallel {
+  seq 1 2000
+  seq 5001 7000
+}
+EOF
+  MYSH_JOBS=2 $MYSH script.sh >output.txt 2>&1
+  order=$(sort -n output.txt | cmp -s - output.txt && echo sorted)
+  [ -z "$order" ] && order=$( (seq 5001 7000; seq 1 2000) | cmp -s - output.txt && echo sorted)
+  assert_equal "parallel output is not interleaved" "sorted" "$order"
+
+  cat >script.sh <<'EOF'
+parallel {
+  true
+  false
+}
+or echo block_failed
+false
+and parallel {
+  echo should_not_run
+}
+parallel {
+  echo unclosed
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "failed line fails the block" "output.txt" "block_failed"
+  TOTAL=$((TOTAL + 1))
+  if ! grep -q "should_not_run" output.txt; then
+    echo -e "${GREEN}PASS${NC}: and skips a parallel block"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: and should skip a parallel block"
+    FAIL=$((FAIL + 1))
+  fi
+  assert_file_contains "unclosed block" "output.txt" "has no closing }"
+}
+
+test_core_builtins() {
+  echo -e "\n${YELLOW}=== Testing echo, printf, test, sleep ===${NC}"
+
+  echo 'printf %s=%d\n a 1 b 2' | $MYSH >output.txt 2>&1
+  assert_equal "printf reuses its format" "a=1 b=2" "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+
+  printf 'printf [%%.3c]\\n x\nprintf [%%5.2c]\\n y\n' >script.sh
+  assert_equal "printf %c ignores a precision" "[x] [    y]" "$($MYSH script.sh 2>&1 | tr '\n' ' ' | sed 's/ $//')"
+
+  echo 'echo -n no_newline > out.txt' | $MYSH >output.txt 2>&1
+  assert_equal "echo -n to a file" "no_newline" "$(cat out.txt)"
+
+  cat >script.sh <<'EOF'
+test -d /
+and [ abc = abc ]
+and echo test_true
+test -f /nonexistent
+or echo test_false
+[ 2 -lt 1 -o ! -e / ]
+or echo compound_false
+sleep 0.1 0.1
+and echo slept
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "test and [ succeed" "output.txt" "test_true"
+  assert_file_contains "test fails" "output.txt" "test_false"
+  assert_file_contains "compound test" "output.txt" "compound_false"
+  assert_file_contains "sleep adds its args" "output.txt" "slept"
+
+  # builtins still work as pipeline stages
+  echo 'printf x\ny\n | wc -l' | $MYSH >output.txt 2>&1
+  assert_file_contains "printf in a pipeline" "output.txt" "2"
+}
+
+test_cat_cp() {
+  echo -e "\n${YELLOW}=== Testing cat and cp ===${NC}"
+
+  head -c 300000 /dev/urandom >big.bin
+  printf 'one\ntwo\n' >small.txt
+  mkdir -p copies
+  cat >script.sh <<'EOF'
+cat big.bin > cat_file.bin
+cat < big.bin | cat | cat > cat_pipe.bin
+cp big.bin cp_file.bin
+cp big.bin small.txt copies
+cat small.txt - < small.txt
+cat -n small.txt
+cat missing.txt
+or echo cat_failed
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  TOTAL=$((TOTAL + 1))
+  if cmp -s big.bin cat_file.bin && cmp -s big.bin cat_pipe.bin &&
+    cmp -s big.bin cp_file.bin && cmp -s big.bin copies/big.bin &&
+    cmp -s small.txt copies/small.txt; then
+    echo -e "${GREEN}PASS${NC}: cat and cp copy files and pipes"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: cat and cp copies differ"
+    FAIL=$((FAIL + 1))
+  fi
+  assert_equal "cat - reads the < file" "2" "$(grep -c '^one$' output.txt)"
+  assert_file_contains "cat -n runs /bin/cat" "output.txt" "2	two"
+  assert_file_contains "cat reports a missing file" "output.txt" "missing.txt"
+  assert_file_contains "cat fails on a missing file" "output.txt" "cat_failed"
+  rm -rf big.bin small.txt copies cat_file.bin cat_pipe.bin cp_file.bin
+}
+
+test_time() {
+  echo -e "\n${YELLOW}=== Testing time ===${NC}"
+
+  cat >script.sh <<'EOF'
+time sleep 0.2
+time -v echo hi | cat | wc -c
+false
+or time true
+and echo timed_true
+EOF
+  $MYSH script.sh >output.txt 2>err.txt
+  assert_equal "time keeps stdout clean" "3 timed_true" "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+  assert_equal "time reports every timed line" "6" "$(grep -c '^time: ' err.txt)"
+  assert_file_contains "time reports wall time" "err.txt" "time: real 0.2"
+  assert_file_contains "time -v reports thread stages" "err.txt" "time: \[1\] cat (thread)"
+  assert_file_contains "time -v reports programs" "err.txt" "time: \[2\] wc (program)"
+  rm -f err.txt
+}
+
+test_trace() {
+  echo -e "\n${YELLOW}=== Testing MYSH_TRACE ===${NC}"
+
+  rm -f trace.json
+  cat >script.sh <<'EOF'
+echo hi | cat | wc -c
+ls > /dev/null
+EOF
+  MYSH_TRACE=trace.json $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "trace has the parsed shape" "trace.json" '"line":1,"ev":"parse_end","stages":3,"argc":\[2,1,2\]'
+  assert_file_contains "trace has lookups" "trace.json" '"ev":"lookup","name":"ls"'
+  assert_file_contains "trace has spawns" "trace.json" '"ev":"spawn","child":'
+  assert_file_contains "trace has the first byte on a ring" "trace.json" '"ev":"first_byte","stage":0'
+  assert_file_contains "trace has child exits" "trace.json" '"ev":"exit","child":[0-9]*,"stage":2,"status":0'
+  assert_equal "every event is one JSON object" "0" "$(grep -cv '^{"ts":[0-9]*,"pid":[0-9]*,.*}$' trace.json)"
+  rm -f trace.json
+}
+
+test_serve() {
+  echo -e "\n${YELLOW}=== Testing --serve and --client ===${NC}"
+
+  local sock="$TEST_DIR/mysh.sock"
+  $MYSH --serve "$sock" 2>serve.log &
+  local server=$!
+  for _ in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$sock" ] && break
+    sleep 0.1
+  done
+
+  mkdir -p served
+  (cd served && $MYSH --client "$sock" -c "pwd" >../output.txt)
+  assert_equal "client runs in its own directory" "$TEST_DIR/served" "$(cat output.txt)"
+
+  assert_equal "client stdin is passed" "3" "$(printf 'a\nb\nc\n' | $MYSH --client "$sock" -c "wc -l")"
+
+  $MYSH --client "$sock" -c "ls /nonexistent_dir" >/dev/null 2>err.txt
+  assert_equal "client gets the exit status" "2" "$?"
+  assert_file_contains "client gets stderr" "err.txt" "nonexistent_dir"
+
+  cat >script.sh <<'EOF'
+echo one
+false
+or echo two
+EOF
+  $MYSH --client "$sock" script.sh >output.txt
+  assert_equal "client runs a script" "one two" "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+
+  local start=$(date +%s%N)
+  for i in 1 2 3 4; do
+    $MYSH --client "$sock" -c "sleep 0.5" &
+  done
+  wait $(jobs -p | grep -v "^$server$")
+  local elapsed=$((($(date +%s%N) - start) / 1000000))
+  TOTAL=$((TOTAL + 1))
+  if [ "$elapsed" -lt 1500 ]; then
+    echo -e "${GREEN}PASS${NC}: requests run concurrently"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: requests run concurrently"
+    echo "  four 0.5s requests took ${elapsed}ms"
+    FAIL=$((FAIL + 1))
+  fi
+
+  # a client that connects and sends nothing must not hold up the others
+  if command -v python3 >/dev/null; then
+    python3 -c 'import socket, sys, time
+s = socket.socket(socket.AF_UNIX); s.connect(sys.argv[1]); time.sleep(3)' "$sock" &
+    local staller=$!
+    sleep 0.2
+    start=$(date +%s%N)
+    assert_equal "a stalled client holds up nobody" "fast" "$($MYSH --client "$sock" -c "echo fast")"
+    elapsed=$((($(date +%s%N) - start) / 1000000))
+    TOTAL=$((TOTAL + 1))
+    if [ "$elapsed" -lt 1000 ]; then
+      echo -e "${GREEN}PASS${NC}: requests are read next to a stalled one"
+      PASS=$((PASS + 1))
+    else
+      echo -e "${RED}FAIL${NC}: requests are read next to a stalled one"
+      echo "  the request took ${elapsed}ms"
+      FAIL=$((FAIL + 1))
+    fi
+    wait "$staller"
+  fi
+
+  kill -TERM "$server"
+  wait "$server"
+  assert_equal "server removes its socket" "no" "$([ -e "$sock" ] && echo yes || echo no)"
+  rm -rf served serve.log err.txt
+}
+
+test_zygote() {
+  echo -e "\n${YELLOW}=== Testing MYSH_SPAWN=zygote ===${NC}"
+
+  mkdir -p zdir
+  touch zdir/marker
+  cat >script.sh <<'EOF'
+cd zdir
+ls
+ls /nonexistent_dir
+or echo failed_as_expected
+seq 1 1000 | sort -n | tail -n 1
+sleep 0.1 &
+wait
+EOF
+  MYSH_SPAWN=zygote $MYSH script.sh >output.txt 2>/dev/null
+  assert_equal "zygote commands run in our directory, with our statuses" \
+    "marker failed_as_expected 1000" "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+  rm -rf zdir
+}
+
+test_here_doc() {
+  echo -e "\n${YELLOW}=== Testing << and <<< ===${NC}"
+
+  {
+    echo "cat <<EOF"
+    echo "first | not a pipe"
+    echo "  second > not a file"
+    echo "EOF"
+    echo "tr a-z A-Z <<< shout | cat"
+    echo "wc -c <<BIG"
+    for i in $(seq 1 20000); do echo "123456789"; done
+    echo "BIG"
+    echo "echo after"
+  } >script.sh
+  expected="first | not a pipe
+  second > not a file
+SHOUT
+200000
+after"
+  assert_equal "here-docs and here-strings" "$expected" "$($MYSH script.sh 2>&1)"
+  assert_equal "here-docs from a pipe" "$expected" "$($MYSH <script.sh 2>&1)"
+  rm -rf cache
+  MYSH_CACHE_DIR=cache $MYSH script.sh >/dev/null 2>&1
+  assert_equal "here-docs from the script cache" "$expected" "$(MYSH_CACHE_DIR=cache $MYSH script.sh 2>&1)"
+  rm -rf cache
+}
+
+test_vars() {
+  echo -e "\n${YELLOW}=== Testing variables ===${NC}"
+
+  cat >script.sh <<'EOF'
+FILE=/tmp/logs/app.log.gz DIR=${FILE%/*}
+BASE=${FILE##*/}
+echo $DIR $BASE ${BASE%%.*} ${BASE#*.} ${#BASE}
+echo ${MISSING:-default} [$MISSING] $ cost $FROM_ENV
+false
+echo status $? > out_$BASE
+cat out_app.log.gz
+FROM_ENV=shadowed
+echo $FROM_ENV
+tr a-z A-Z <<< ${BASE%.gz}
+echo ${bad:x}
+or echo failed
+echo done
+EOF
+  expected="/tmp/logs app.log.gz app log.gz 10
+default [] \$ cost outside
+status 1
+shadowed
+APP.LOG
+\${bad:x}: bad substitution
+failed
+done"
+  assert_equal "variables and parameter operators" "$expected" "$(FROM_ENV=outside $MYSH script.sh 2>&1)"
+  rm -rf cache
+  FROM_ENV=outside MYSH_CACHE_DIR=cache $MYSH script.sh >/dev/null 2>&1
+  assert_equal "variables from the script cache" "$expected" \
+    "$(FROM_ENV=outside MYSH_CACHE_DIR=cache $MYSH script.sh 2>&1)"
+  rm -rf cache out_app.log.gz
+
+  printf 'time -v COUNT=2\necho count $COUNT\n' >script.sh
+  $MYSH script.sh >output.txt 2>err.txt
+  assert_equal "a timed assignment is done" "count 2" "$(cat output.txt)"
+  assert_file_contains "a timed assignment is timed" "err.txt" "time: \[0\] COUNT=2 (shell)"
+  rm -f err.txt
+}
+
+test_output() {
+  echo -e "\n${YELLOW}=== Testing buffered builtin output ===${NC}"
+
+  # builtin cat of /proc/self/io runs in the shell, so it reads our own
+  # count of write syscalls
+  for i in $(seq 1 200); do echo "echo line $i"; done >script.sh
+  echo "cat /proc/self/io" >>script.sh
+  $MYSH script.sh >output.txt 2>/dev/null
+  assert_equal "builtin output is all there" "200" "$(grep -c '^line' output.txt)"
+  local writes=$(sed -n 's/^syscw: //p' output.txt)
+  TOTAL=$((TOTAL + 1))
+  if [ -n "$writes" ] && [ "$writes" -lt 10 ]; then
+    echo -e "${GREEN}PASS${NC}: 200 echo lines take few writes"
+    PASS=$((PASS + 1))
+  else
+    echo -e "${RED}FAIL${NC}: 200 echo lines took $writes writes"
+    FAIL=$((FAIL + 1))
+  fi
+
+  cat >script.sh <<'EOF'
+echo one
+ls -d /
+echo two | cat
+pwd
+die three > die.txt
+EOF
+  $MYSH script.sh >output.txt 2>/dev/null
+  assert_equal "buffered output keeps its order" "one / two $TEST_DIR Exiting mysh..." \
+    "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+  assert_equal "die writes to its redirect" "three" "$(cat die.txt)"
+  rm -f die.txt
+}
+
+test_memo() {
+  echo -e "\n${YELLOW}=== Testing memo ===${NC}"
+
+  # counts its runs in ran.txt, so a replay shows as a missing line
+  cat >gen.sh <<'EOF'
+#!/bin/sh
+echo ran >>ran.txt
+cat dep.txt
+exit 1
+EOF
+  chmod +x gen.sh
+  cat >script.sh <<'EOF'
+memo -d dep.txt ./gen.sh
+memo -d dep.txt ./gen.sh
+or echo failed
+memo sort < unsorted.txt | head -n 1
+memo -s
+EOF
+  printf 'c\na\nb\n' >unsorted.txt
+  echo one >dep.txt
+  rm -rf cache ran.txt
+  MYSH_CACHE_DIR=cache $MYSH script.sh >output.txt 2>&1
+  assert_equal "memo replays output and status" "one one failed a hits 1 misses 1 uncached 0 entries 2 bytes 42" \
+    "$(tr '\n' ' ' <output.txt | sed 's/ $//')"
+  assert_equal "memo runs a command once" "1" "$(wc -l <ran.txt)"
+
+  printf 'memo -d dep.txt ./gen.sh\n' >script.sh
+  echo two >dep.txt
+  assert_equal "memo reruns when a dependency changes" "two" "$(MYSH_CACHE_DIR=cache $MYSH script.sh)"
+  assert_equal "memo reran once" "2" "$(wc -l <ran.txt)"
+  assert_equal "memo without a store just runs" "two" "$($MYSH script.sh)"
+
+  printf 'memo -r\nmemo -s\n' >script.sh
+  assert_equal "memo -r empties the store" "hits 0 misses 0 uncached 0 entries 0 bytes 0" \
+    "$(MYSH_CACHE_DIR=cache $MYSH script.sh)"
+  rm -rf cache gen.sh dep.txt ran.txt unsorted.txt
 }
 
 test_exit_command() {
@@ -363,6 +905,24 @@ EOF
   assert_file_contains "relative path" "output.txt" "script executed"
 
   echo "nonexistent_command_xyz" | $MYSH >output.txt 2>&1
+
+  cat >script.sh <<'EOF'
+hash ls
+ls > /dev/null
+hash
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "hash lists cached path" "output.txt" "/ls"
+
+  cat >script.sh <<'EOF'
+ls > /dev/null
+hash -r
+hash
+EOF
+  $MYSH script.sh >output.txt 2>&1
+  local
+  size=$(stat -c%s output.txt 2>/dev/null || stat -f%z output.txt 2>/dev/null)
+  assert_equal "hash -r clears the cache" "0" "$size"
 }
 
 test_complex_scenarios() {
@@ -417,6 +977,22 @@ EOF
   echo "echo    hello    world" | $MYSH >output.txt 2>&1
   assert_file_contains "multiple spaces" "output.txt" "hello"
   assert_file_contains "multiple spaces" "output.txt" "world"
+
+  long_arg=$(head -c 5000 /dev/zero | tr '\0' 'x')
+  echo "echo $long_arg end_of_long_line" | $MYSH >output.txt 2>&1
+  assert_file_contains "line longer than 1kb" "output.txt" "end_of_long_line"
+
+  printf 'echo first\necho %s\necho after_long\n' "$long_arg" >script.sh
+  MYSH_MAX_LINE=1000 $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "line over MYSH_MAX_LINE is reported" "output.txt" "line 2 is longer than 1000 bytes"
+  assert_file_contains "lines after a too long line still run" "output.txt" "after_long"
+
+  printf 'echo no_trailing_newline' | $MYSH >output.txt 2>&1
+  assert_file_contains "last line without newline" "output.txt" "no_trailing_newline"
+
+  seq 1 3000 | sed 's/^/echo line/' >script.sh
+  MYSH_READ_SIZE=7 $MYSH script.sh >output.txt 2>&1
+  assert_file_contains "tiny read size" "output.txt" "line3000"
 }
 
 main() {
@@ -434,6 +1010,20 @@ main() {
   test_conditionals_and
   test_conditionals_or
   test_batch_mode
+  test_script_cache
+  test_jobs
+  test_background_jobs
+  test_parallel_block
+  test_core_builtins
+  test_cat_cp
+  test_time
+  test_trace
+  test_serve
+  test_zygote
+  test_here_doc
+  test_vars
+  test_output
+  test_memo
   test_exit_command
   test_die_command
   test_path_resolution
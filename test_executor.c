@@ -1,6 +1,11 @@
 #define _POSIX_C_SOURCE 200809L
 #include "parser.h"
 #include "executor.h"
+#include "jobs.h"
+#include "memo.h"
+#include "path_cache.h"
+#include "spawner.h"
+#include "vars.h"
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -8,6 +13,7 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 // REPLACE
@@ -95,7 +101,7 @@ static char original_cwd[1024];
 
 ParsedCmd *make_cmd(int num_commands, int is_and, int is_or,
                     const char *input_file, const char *output_file) {
-  ParsedCmd *cmd = malloc(sizeof(ParsedCmd));
+  ParsedCmd *cmd = calloc(1, sizeof(ParsedCmd));
   if (!cmd)
     return NULL;
 
@@ -488,6 +494,320 @@ cleanup:
   free_cmd(cmd);
 }
 
+void test_fork_backend(void) {
+  TEST_START("fork spawn backend");
+
+  char outfile[1024];
+  snprintf(outfile, sizeof(outfile), "%s/fork_out.txt", test_dir);
+
+  ParsedCmd *cmd = make_cmd(2, 0, 0, NULL, outfile);
+  set_args(cmd, 0, 2, "echo", "forked");
+  set_args(cmd, 1, 1, "cat");
+
+  int should_exit = 0;
+  spawner_set_backend(SPAWN_FORK);
+  int result = execute(cmd, 0, 1, &should_exit);
+
+  ASSERT_EQUAL(result, 0);
+
+  char *content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  int found = strstr(content, "forked") != NULL;
+  free(content);
+  ASSERT_TRUE(found);
+
+  TEST_PASS();
+
+cleanup:
+  spawner_set_backend(SPAWN_POSIX);
+  unlink(outfile);
+  free_cmd(cmd);
+}
+
+void test_zygote_backend(void) {
+  TEST_START("zygote spawn backend");
+
+  char outfile[1024];
+  snprintf(outfile, sizeof(outfile), "%s/zygote_out.txt", test_dir);
+
+  ParsedCmd *cmd = make_cmd(2, 0, 0, NULL, outfile);
+  set_args(cmd, 0, 3, "ls", "-d", test_dir);
+  set_args(cmd, 1, 2, "wc", "-l");
+  ParsedCmd *missing = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(missing, 0, 2, "ls", "/nonexistent_zygote_dir");
+
+  int should_exit = 0;
+  spawner_set_backend(SPAWN_ZYGOTE);
+  ASSERT_EQUAL(spawner_get_backend(), SPAWN_ZYGOTE);
+  int result = execute(cmd, 0, 1, &should_exit);
+  ASSERT_EQUAL(result, 0);
+
+  char *content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  int count = atoi(content);
+  free(content);
+  ASSERT_EQUAL(count, 1);
+
+  // the status comes from our own wait4() on the zygote's child
+  int saved_stderr = dup(STDERR_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDERR_FILENO);
+  close(null_fd);
+  result = execute(missing, 0, 1, &should_exit);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+  ASSERT_EQUAL(result, 2);
+
+  TEST_PASS();
+
+cleanup:
+  spawner_set_backend(SPAWN_POSIX);
+  unlink(outfile);
+  free_cmd(cmd);
+  free_cmd(missing);
+}
+
+void test_memo(void) {
+  TEST_START("memo replays a command");
+
+  char cache[1024], store[1100], infile[1024], outfile[1024];
+  snprintf(cache, sizeof(cache), "%s/memo_cache", test_dir);
+  snprintf(store, sizeof(store), "%s/memo", cache);
+  snprintf(infile, sizeof(infile), "%s/memo_in.txt", test_dir);
+  snprintf(outfile, sizeof(outfile), "%s/memo_out.txt", test_dir);
+  // read once, at the first memo
+  setenv("MYSH_CACHE_DIR", cache, 1);
+  make_file(infile, "b\na\n");
+
+  ParsedCmd *cmd = make_cmd(1, 0, 0, infile, outfile);
+  set_args(cmd, 0, 2, "memo", "sort");
+
+  int should_exit = 0;
+  MemoStats stats;
+  char *content = NULL;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQUAL(execute(cmd, 0, 1, &should_exit), 0);
+    content = read_file(outfile);
+    ASSERT_TRUE(content != NULL);
+    ASSERT_STR_EQUAL(content, "a\nb\n");
+    free(content);
+    content = NULL;
+  }
+  memo_stats(&stats);
+  ASSERT_EQUAL((int)stats.hits, 1);
+  ASSERT_EQUAL((int)stats.misses, 1);
+  ASSERT_EQUAL(stats.entries, 1);
+
+  // new input, new key
+  make_file(infile, "d\nc\n");
+  ASSERT_EQUAL(execute(cmd, 0, 1, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "c\nd\n");
+  memo_stats(&stats);
+  ASSERT_EQUAL((int)stats.misses, 2);
+  // the store was gone through at the first miss only
+  ASSERT_EQUAL((int)stats.scans, 1);
+
+  // over the size limit, the next miss goes through it and evicts
+  setenv("MYSH_MEMO_MAX_BYTES", "1", 1);
+  make_file(infile, "f\ne\n");
+  ASSERT_EQUAL(execute(cmd, 0, 1, &should_exit), 0);
+  free(content);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "e\nf\n");
+  memo_stats(&stats);
+  ASSERT_EQUAL((int)stats.scans, 2);
+  ASSERT_EQUAL(stats.entries, 0);
+
+  TEST_PASS();
+
+cleanup:
+  free(content);
+  memo_clear();
+  rmdir(store);
+  rmdir(cache);
+  unsetenv("MYSH_CACHE_DIR");
+  unsetenv("MYSH_MEMO_MAX_BYTES");
+  unlink(infile);
+  unlink(outfile);
+  free_cmd(cmd);
+}
+
+void test_background_jobs(void) {
+  TEST_START("background jobs and wait");
+
+  ParsedCmd *sleeper = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(sleeper, 0, 2, "sleep", "0.3");
+  sleeper->is_background = 1;
+  ParsedCmd *failing = make_cmd(2, 0, 0, NULL, NULL);
+  set_args(failing, 0, 1, "true");
+  set_args(failing, 1, 1, "false");
+  failing->is_background = 1;
+  ParsedCmd *quick = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(quick, 0, 1, "true");
+  quick->is_background = 1;
+  ParsedCmd *wait_next = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(wait_next, 0, 2, "wait", "-n");
+  ParsedCmd *wait_all = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(wait_all, 0, 1, "wait");
+
+  int should_exit = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int started = execute(sleeper, 0, 0, &should_exit);
+  int started_pipeline = execute(failing, 0, 0, &should_exit);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  //starting a job succeeds without waiting for it
+  ASSERT_EQUAL(started, 0);
+  ASSERT_EQUAL(started_pipeline, 0);
+  ASSERT_TRUE(elapsed < 0.25);
+
+  //the pipeline finishes first and wait -n reports its failure
+  ASSERT_EQUAL(execute(wait_next, 0, 0, &should_exit), 1);
+  ASSERT_EQUAL(execute(wait_all, 0, 0, &should_exit), 0);
+  //nothing left to wait for
+  ASSERT_EQUAL(execute(wait_next, 0, 0, &should_exit), 127);
+
+  //jobs nobody waits for are forgotten once too many have finished
+  for (int i = 0; i < MAX_DONE_JOBS + 200; i++) {
+    ASSERT_EQUAL(execute(quick, 0, 0, &should_exit), 0);
+    if (i % 100 == 0) {
+      usleep(20000);
+    }
+  }
+  ASSERT_TRUE(jobs_count() <= MAX_DONE_JOBS + 100);
+  execute(wait_all, 0, 0, &should_exit);
+  ASSERT_EQUAL(jobs_count(), 0);
+
+  TEST_PASS();
+
+cleanup:
+  free_cmd(sleeper);
+  free_cmd(failing);
+  free_cmd(quick);
+  free_cmd(wait_next);
+  free_cmd(wait_all);
+}
+
+void test_core_builtins(void) {
+  TEST_START("echo, printf and test run in the shell");
+
+  char outfile[1024];
+  snprintf(outfile, sizeof(outfile), "%s/builtin_out.txt", test_dir);
+
+  ParsedCmd *echo = make_cmd(1, 0, 0, NULL, outfile);
+  set_args(echo, 0, 3, "echo", "-n", "one");
+  ParsedCmd *print = make_cmd(1, 0, 0, NULL, outfile);
+  set_args(print, 0, 5, "printf", "[%s:%03d]", "a", "7", "b");
+  ParsedCmd *is_file = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(is_file, 0, 3, "test", "-f", outfile);
+  ParsedCmd *bracket = make_cmd(1, 0, 0, NULL, NULL);
+  set_args(bracket, 0, 5, "[", "3", "-gt", "4", "]");
+  char *content = NULL;
+
+  //no PATH lookup at all, so nothing goes through the path cache
+  path_cache_clear();
+  int should_exit = 0;
+  ASSERT_EQUAL(execute(echo, 0, 0, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "one");
+  free(content);
+  content = NULL;
+
+  ASSERT_EQUAL(execute(print, 0, 0, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "[a:007][b:000]");
+
+  ASSERT_EQUAL(execute(is_file, 0, 0, &should_exit), 0);
+  ASSERT_EQUAL(execute(bracket, 0, 0, &should_exit), 1);
+
+  PathCacheStats stats;
+  path_cache_stats(&stats);
+  ASSERT_EQUAL(stats.entries, 0);
+
+  TEST_PASS();
+
+cleanup:
+  free(content);
+  unlink(outfile);
+  free_cmd(echo);
+  free_cmd(print);
+  free_cmd(is_file);
+  free_cmd(bracket);
+}
+
+void test_builtin_registry(void) {
+  TEST_START("every builtin is found in the registry");
+
+  const char *names[] = {"cd", "pwd", "which", "exit", "die", "set", "hash",
+                         "wait", "echo", "true", "false", "test", "[",
+                         "sleep", "printf", "cat", "cp"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    const Builtin *builtin = find_builtin(names[i]);
+    ASSERT_TRUE(builtin != NULL);
+    ASSERT_STR_EQUAL(builtin->name, names[i]);
+  }
+  ASSERT_TRUE(find_builtin("ls") == NULL);
+  ASSERT_TRUE(find_builtin("") == NULL);
+  ASSERT_TRUE(find_builtin("echoo") == NULL);
+  ASSERT_TRUE(find_builtin("cd")->flags == 0);
+  ASSERT_TRUE(find_builtin("echo")->flags & BUILTIN_STANDIN);
+
+  TEST_PASS();
+
+cleanup:
+  return;
+}
+
+void test_path_cache(void) {
+  TEST_START("path cache hits and negative entries");
+
+  //true is a builtin now, ls still goes through the cache
+  ParsedCmd *cmd = make_cmd(1, 0, 0, NULL, "/dev/null");
+  set_args(cmd, 0, 1, "ls");
+
+  int should_exit = 0;
+  path_cache_clear();
+
+  PathCacheStats before, after;
+  path_cache_stats(&before);
+  execute(cmd, 0, 1, &should_exit);
+  execute(cmd, 0, 1, &should_exit);
+  path_cache_stats(&after);
+
+  ASSERT_EQUAL((int)(after.misses - before.misses), 1);
+  ASSERT_EQUAL((int)(after.hits - before.hits), 1);
+
+  ASSERT_TRUE(path_cache_lookup("nonexistent_xyz_command") == NULL);
+  ASSERT_TRUE(path_cache_lookup("nonexistent_xyz_command") == NULL);
+  path_cache_stats(&after);
+  ASSERT_EQUAL(after.negative, 1);
+  ASSERT_EQUAL((int)(after.misses - before.misses), 2);
+
+  //a seed keeps paths handed out before valid
+  const char *ls_path = path_cache_lookup("ls");
+  ASSERT_TRUE(ls_path != NULL);
+  ASSERT_EQUAL(path_cache_seed("ls"), 0);
+  ASSERT_TRUE(path_cache_lookup("ls") == ls_path);
+  ASSERT_TRUE(strstr(ls_path, "/ls") != NULL);
+
+  path_cache_clear();
+  path_cache_stats(&after);
+  ASSERT_EQUAL(after.entries, 0);
+
+  TEST_PASS();
+
+cleanup:
+  free_cmd(cmd);
+}
+
 // I/O redirection
 
 void test_input_redirect(void) {
@@ -521,6 +841,109 @@ cleanup:
   free_cmd(cmd);
 }
 
+void test_here_doc_input(void) {
+  TEST_START("here-doc bodies as stdin");
+
+  char outfile[1024];
+  snprintf(outfile, sizeof(outfile), "%s/here_doc.txt", test_dir);
+  // bigger than any pipe, it must not wait for a reader
+  size_t big_len = 4 * 1024 * 1024;
+  char *big = malloc(big_len);
+  ParsedCmd *small = make_cmd(1, 0, 0, NULL, outfile);
+  set_args(small, 0, 1, "cat");
+  small->input_text = "one\ntwo\n";
+  small->input_text_len = 8;
+  ParsedCmd *large = make_cmd(1, 0, 0, NULL, outfile);
+  set_args(large, 0, 2, "wc", "-c");
+
+  int should_exit = 0;
+  char *content = NULL;
+  ASSERT_TRUE(big != NULL);
+  memset(big, 'x', big_len);
+  large->input_text = big;
+  large->input_text_len = big_len;
+
+  ASSERT_EQUAL(execute(small, 0, 1, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "one\ntwo\n");
+  free(content);
+  content = NULL;
+
+  ASSERT_EQUAL(execute(large, 0, 1, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_EQUAL(atol(content), (long)big_len);
+
+  TEST_PASS();
+
+cleanup:
+  free(content);
+  free(big);
+  unlink(outfile);
+  free_cmd(small);
+  free_cmd(large);
+}
+
+void test_vars(void) {
+  TEST_START("variables and expansion");
+
+  char outfile[1024], line[1200];
+  snprintf(outfile, sizeof(outfile), "%s/vars.txt", test_dir);
+  ParsedCmd *assign = parse("NAME=report.tar.gz COPY=$NAME");
+  ParsedCmd *reassign = parse("NAME=other");
+  snprintf(line, sizeof(line),
+           "echo $COPY ${NAME%%%%.*} ${NAME#*.} ${#NAME} ${NONE:-x$?} > %s", outfile);
+  ParsedCmd *echo = parse(line);
+  snprintf(line, sizeof(line), "cat <<< ${NAME%%%%.*}:$? > %s", outfile);
+  ParsedCmd *here_string = parse(line);
+  ParsedCmd *bad = parse("echo ${NAME:x}");
+  ParsedCmd *not_assign = parse("NAME=x > /dev/null");
+
+  int should_exit = 0;
+  char *content = NULL;
+  ASSERT_TRUE(assign != NULL && reassign != NULL && echo != NULL && here_string != NULL &&
+              bad != NULL && not_assign != NULL);
+  ASSERT_EQUAL(execute(assign, 0, 1, &should_exit), 0);
+  ASSERT_STR_EQUAL(vars_get("COPY"), "report.tar.gz");
+  // COPY keeps the value it shares
+  ASSERT_EQUAL(execute(reassign, 0, 1, &should_exit), 0);
+  ASSERT_STR_EQUAL(vars_get("COPY"), "report.tar.gz");
+  ASSERT_STR_EQUAL(vars_get("NAME"), "other");
+
+  ASSERT_EQUAL(vars_set("NAME", "report.tar.gz"), 0);
+  ASSERT_EQUAL(execute(echo, 1, 1, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "report.tar.gz report tar.gz 13 x1\n");
+  free(content);
+  content = NULL;
+
+  // the word of a <<< is expanded like an arg
+  ASSERT_EQUAL(execute(here_string, 2, 1, &should_exit), 0);
+  content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  ASSERT_STR_EQUAL(content, "report:2\n");
+
+  ASSERT_EQUAL(execute(bad, 0, 1, &should_exit), 1);
+  ASSERT_EQUAL(execute(not_assign, 0, 1, &should_exit), 1);
+  // the environment is seen through
+  ASSERT_TRUE(vars_get("PATH") != NULL);
+  ASSERT_TRUE(vars_get("MYSH_NO_SUCH_VARIABLE") == NULL);
+
+  TEST_PASS();
+
+cleanup:
+  free(content);
+  unlink(outfile);
+  free_parsed_cmd(assign);
+  free_parsed_cmd(reassign);
+  free_parsed_cmd(echo);
+  free_parsed_cmd(here_string);
+  free_parsed_cmd(bad);
+  free_parsed_cmd(not_assign);
+}
+
 void test_output_redirect(void) {
   TEST_START("output redirection");
 
@@ -625,6 +1048,125 @@ cleanup:
   free_cmd(cmd);
 }
 
+void test_pipestatus(void) {
+  TEST_START("pipestatus records every stage");
+
+  ParsedCmd *cmd = make_cmd(3, 0, 0, NULL, NULL);
+  set_args(cmd, 0, 1, "false");
+  set_args(cmd, 1, 1, "true");
+  set_args(cmd, 2, 1, "true");
+
+  int should_exit = 0;
+  int result = execute(cmd, 0, 1, &should_exit);
+
+  ASSERT_EQUAL(result, 0);
+
+  int count = 0;
+  const int *statuses = get_pipestatus(&count);
+  ASSERT_EQUAL(count, 3);
+  ASSERT_EQUAL(statuses[0], 1);
+  ASSERT_EQUAL(statuses[1], 0);
+  ASSERT_EQUAL(statuses[2], 0);
+
+  TEST_PASS();
+
+cleanup:
+  free_cmd(cmd);
+}
+
+void test_pipefail(void) {
+  TEST_START("pipefail returns failing stage status");
+
+  ParsedCmd *cmd = make_cmd(2, 0, 0, NULL, NULL);
+  set_args(cmd, 0, 1, "false");
+  set_args(cmd, 1, 1, "true");
+
+  int should_exit = 0;
+  set_pipefail(1);
+  int result = execute(cmd, 0, 1, &should_exit);
+
+  ASSERT_EQUAL(result, 1);
+
+  TEST_PASS();
+
+cleanup:
+  set_pipefail(0);
+  free_cmd(cmd);
+}
+
+void test_pipeline_large_output(void) {
+  TEST_START("pipeline larger than a pipe buffer");
+
+  char outfile[1024];
+  snprintf(outfile, sizeof(outfile), "%s/seq_out.txt", test_dir);
+
+  // seq writes far more than 64k, so the stages have to run at the same time
+  ParsedCmd *cmd = make_cmd(3, 0, 0, NULL, outfile);
+  set_args(cmd, 0, 2, "seq", "200000");
+  set_args(cmd, 1, 1, "cat");
+  set_args(cmd, 2, 2, "wc", "-l");
+
+  int should_exit = 0;
+  int result = execute(cmd, 0, 1, &should_exit);
+
+  ASSERT_EQUAL(result, 0);
+
+  char *content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  int lines = atoi(content);
+  free(content);
+  ASSERT_EQUAL(lines, 200000);
+
+  TEST_PASS();
+
+cleanup:
+  unlink(outfile);
+  free_cmd(cmd);
+}
+
+void test_builtin_pipeline(void) {
+  TEST_START("builtin stages run on threads over rings");
+
+  char outfile[1024];
+  snprintf(outfile, sizeof(outfile), "%s/ring_out.txt", test_dir);
+
+  // the cats are threads: a pipe in from seq, two rings, a pipe out to wc
+  ParsedCmd *cmd = make_cmd(5, 0, 0, NULL, outfile);
+  set_args(cmd, 0, 2, "seq", "200000");
+  set_args(cmd, 1, 1, "cat");
+  set_args(cmd, 2, 1, "cat");
+  set_args(cmd, 3, 1, "cat");
+  set_args(cmd, 4, 2, "wc", "-l");
+
+  // true never reads, so cat has to give up on the ring instead of hanging
+  ParsedCmd *endless = make_cmd(2, 0, 0, NULL, NULL);
+  set_args(endless, 0, 2, "cat", "/dev/zero");
+  set_args(endless, 1, 1, "true");
+
+  int should_exit = 0;
+  ASSERT_EQUAL(execute(cmd, 0, 1, &should_exit), 0);
+
+  char *content = read_file(outfile);
+  ASSERT_TRUE(content != NULL);
+  int lines = atoi(content);
+  free(content);
+  ASSERT_EQUAL(lines, 200000);
+
+  ASSERT_EQUAL(execute(endless, 0, 1, &should_exit), 0);
+  int count = 0;
+  const int *statuses = get_pipestatus(&count);
+  ASSERT_EQUAL(count, 2);
+  ASSERT_EQUAL(statuses[0], 1);
+  ASSERT_EQUAL(should_exit, 0);
+
+  TEST_PASS();
+
+cleanup:
+  unlink(outfile);
+  free_cmd(cmd);
+  free_cmd(endless);
+}
+
 // Errors
 
 void test_null_command(void) {
@@ -702,15 +1244,28 @@ int main(void) {
   test_true_command();
   test_false_command();
   test_nonexistent_command();
+  test_core_builtins();
+  test_builtin_registry();
+  test_path_cache();
+  test_fork_backend();
+  test_zygote_backend();
+  test_memo();
+  test_background_jobs();
 
   printf("\n" COLOR_YELLOW "I/O Redirection:\n" COLOR_RESET);
   test_input_redirect();
+  test_here_doc_input();
   test_output_redirect();
   test_both_redirect();
+  test_vars();
 
   printf("\n" COLOR_YELLOW "Pipelines:\n" COLOR_RESET);
   test_simple_pipeline();
   test_pipeline_status();
+  test_pipestatus();
+  test_pipefail();
+  test_pipeline_large_output();
+  test_builtin_pipeline();
 
   printf("\n" COLOR_YELLOW "Error Cases:\n" COLOR_RESET);
   test_null_command();
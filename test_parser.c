@@ -438,6 +438,296 @@ void test_free_null_cmd(void) {
   CU_PASS("free_parsed_cmd(NULL) did not crash");
 }
 
+void test_many_args(void) {
+  ParsedCmd *cmd = parse("echo 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->commands[0].num_args, 16);
+    CU_ASSERT_STRING_EQUAL(cmd->commands[0].args[15], "15");
+    CU_ASSERT_PTR_NULL(cmd->commands[0].args[16]);
+    free_parsed_cmd(cmd);
+  }
+}
+
+void test_single_block(void) {
+  ParsedCmd *cmd = parse("cat < in.txt | grep x > out.txt");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    // every pointer lands inside the one allocation
+    char *start = (char *)cmd;
+    char *end = cmd->output_file + strlen(cmd->output_file) + 1;
+    CU_ASSERT_TRUE((char *)cmd->commands > start);
+    CU_ASSERT_TRUE(cmd->commands[1].args[1] > start);
+    CU_ASSERT_TRUE(cmd->commands[1].args[1] < end);
+    CU_ASSERT_TRUE(cmd->input_file > start && cmd->input_file < end);
+    free_parsed_cmd(cmd);
+  }
+}
+
+void test_parse_arena(void) {
+  Arena arena;
+  arena_init(&arena, 64);
+  for (int i = 0; i < 100; i++) {
+    ParsedCmd *cmd = parse_arena("and ls -la | wc -l > out.txt", &arena);
+    CU_ASSERT_PTR_NOT_NULL(cmd);
+    if (cmd) {
+      CU_ASSERT_EQUAL(cmd->is_and, 1);
+      CU_ASSERT_EQUAL(cmd->num_commands, 2);
+      char *expected[] = {"wc", "-l"};
+      CU_ASSERT_TRUE(verify_command_args(&cmd->commands[1], 2, expected));
+      CU_ASSERT_STRING_EQUAL(cmd->output_file, "out.txt");
+    }
+    arena_reset(&arena);
+  }
+  CU_ASSERT_PTR_NULL(parse_arena("# comment", &arena));
+  arena_free(&arena);
+}
+
+void test_tokenize_spans(void) {
+  Arena arena;
+  arena_init(&arena, 256);
+  const char *line = "and cat<in|grep or >out # and";
+  Token *tokens;
+  int count = tokenize(line, strlen(line), &arena, &tokens);
+  CU_ASSERT_EQUAL(count, 9);
+  if (count == 9) {
+    TokenKind kinds[] = {TOKEN_AND,  TOKEN_WORD, TOKEN_INPUT,
+                         TOKEN_WORD, TOKEN_PIPE, TOKEN_WORD,
+                         TOKEN_OR,   TOKEN_OUTPUT, TOKEN_WORD};
+    for (int i = 0; i < count; i++) {
+      CU_ASSERT_EQUAL(tokens[i].kind, kinds[i]);
+    }
+    // spans point back into the line
+    CU_ASSERT_EQUAL(tokens[1].offset, 4);
+    CU_ASSERT_EQUAL(tokens[1].length, 3);
+    CU_ASSERT_EQUAL(tokens[8].offset, 20);
+    CU_ASSERT_EQUAL(tokens[8].length, 3);
+  }
+  arena_free(&arena);
+}
+
+void test_keyword_as_argument(void) {
+  ParsedCmd *cmd = parse("echo and or > or");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_and, 0);
+    char *expected[] = {"echo", "and", "or"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 3, expected));
+    CU_ASSERT_STRING_EQUAL(cmd->output_file, "or");
+    free_parsed_cmd(cmd);
+  }
+}
+
+void test_background(void) {
+  ParsedCmd *cmd = parse("and sleep 1 | cat > out.txt &");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_background, 1);
+    CU_ASSERT_EQUAL(cmd->is_and, 1);
+    CU_ASSERT_EQUAL(cmd->num_commands, 2);
+    CU_ASSERT_STRING_EQUAL(cmd->output_file, "out.txt");
+    free_parsed_cmd(cmd);
+  }
+
+  // & needs no space before it
+  cmd = parse("echo hi&");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_background, 1);
+    char *expected[] = {"echo", "hi"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 2, expected));
+    free_parsed_cmd(cmd);
+  }
+
+  cmd = parse("echo hi");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_background, 0);
+    free_parsed_cmd(cmd);
+  }
+
+  // inside a word & is just a character
+  cmd = parse("echo a&b");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_background, 0);
+    char *expected[] = {"echo", "a&b"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 2, expected));
+    free_parsed_cmd(cmd);
+  }
+
+  // only at the end of the line
+  CU_ASSERT_PTR_NULL(parse("sleep 1 & echo hi"));
+  CU_ASSERT_PTR_NULL(parse("&"));
+  CU_ASSERT_PTR_NULL(parse("echo hi & &"));
+}
+
+void test_time_prefix(void) {
+  ParsedCmd *cmd = parse("or time cat in.txt | wc -l");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_timed, 1);
+    CU_ASSERT_EQUAL(cmd->is_or, 1);
+    CU_ASSERT_EQUAL(cmd->num_commands, 2);
+    char *expected[] = {"cat", "in.txt"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 2, expected));
+    free_parsed_cmd(cmd);
+  }
+
+  cmd = parse("time -v sleep 1");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_timed, 2);
+    char *expected[] = {"sleep", "1"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 2, expected));
+    free_parsed_cmd(cmd);
+  }
+
+  // only a keyword at the start
+  cmd = parse("echo time");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->is_timed, 0);
+    char *expected[] = {"echo", "time"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 2, expected));
+    free_parsed_cmd(cmd);
+  }
+
+  CU_ASSERT_PTR_NULL(parse("time"));
+  CU_ASSERT_PTR_NULL(parse("time -v"));
+}
+
+void test_parse_line_length(void) {
+  Arena arena;
+  arena_init(&arena, 256);
+  // only the first line counts, there is no '\0' after it
+  const char *text = "ls -la\necho next";
+  ParsedCmd *cmd = parse_line(text, 6, &arena);
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    char *expected[] = {"ls", "-la"};
+    CU_ASSERT_TRUE(verify_command_args(&cmd->commands[0], 2, expected));
+  }
+  arena_free(&arena);
+}
+
+void test_here_string(void) {
+  ParsedCmd *cmd = parse("tr a-z A-Z <<< shout | cat");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_EQUAL(cmd->num_commands, 2);
+    CU_ASSERT_PTR_NULL(cmd->input_file);
+    CU_ASSERT_PTR_NULL(cmd->here_doc_end);
+    CU_ASSERT_STRING_EQUAL(cmd->input_text, "shout\n");
+    CU_ASSERT_EQUAL(cmd->input_text_len, 6);
+    CU_ASSERT_EQUAL(cmd->is_here_string, 1);
+    free_parsed_cmd(cmd);
+  }
+
+  // the last of <, << and <<< takes stdin
+  cmd = parse("cat <<<word < in.txt");
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_STRING_EQUAL(cmd->input_file, "in.txt");
+    CU_ASSERT_PTR_NULL(cmd->input_text);
+    free_parsed_cmd(cmd);
+  }
+
+  CU_ASSERT_PTR_NULL(parse("cat <<<"));
+  CU_ASSERT_PTR_NULL(parse("cat << | wc"));
+}
+
+// hands out the lines of a NULL-terminated array, for parse_here_doc()
+static int next_test_line(void *source, const char **line, size_t *length) {
+  const char ***lines = source;
+  if (**lines == NULL) {
+    return 0;
+  }
+  *line = **lines;
+  *length = strlen(**lines);
+  (*lines)++;
+  return 1;
+}
+
+void test_here_doc(void) {
+  Arena arena;
+  arena_init(&arena, 256);
+  ParsedCmd *cmd = parse_arena("sort <<END > out.txt", &arena);
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    CU_ASSERT_STRING_EQUAL(cmd->here_doc_end, "END");
+    CU_ASSERT_STRING_EQUAL(cmd->output_file, "out.txt");
+    CU_ASSERT_PTR_NULL(cmd->input_text);
+
+    // stops at the delimiter, what follows is the next command
+    const char *body[] = {"b | not a pipe", "a", "END", "echo next", NULL};
+    const char **next = body;
+    CU_ASSERT_EQUAL(parse_here_doc(cmd, next_test_line, &next, &arena), 0);
+    CU_ASSERT_STRING_EQUAL(cmd->input_text, "b | not a pipe\na\n");
+    CU_ASSERT_EQUAL(cmd->input_text_len, 17);
+    CU_ASSERT_EQUAL(cmd->is_here_string, 0);
+    CU_ASSERT_STRING_EQUAL(*next, "echo next");
+  }
+
+  // no delimiter, the body runs to the end
+  cmd = parse_arena("cat <<EOF", &arena);
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    const char *body[] = {"only line", NULL};
+    const char **next = body;
+    CU_ASSERT_EQUAL(parse_here_doc(cmd, next_test_line, &next, &arena), 0);
+    CU_ASSERT_STRING_EQUAL(cmd->input_text, "only line\n");
+  }
+
+  // a later < takes stdin, the body is still read past
+  cmd = parse_arena("cat <<EOF < in.txt", &arena);
+  CU_ASSERT_PTR_NOT_NULL(cmd);
+  if (cmd) {
+    const char *body[] = {"skipped", "EOF", NULL};
+    const char **next = body;
+    CU_ASSERT_EQUAL(parse_here_doc(cmd, next_test_line, &next, &arena), 0);
+    CU_ASSERT_PTR_NULL(cmd->input_text);
+    CU_ASSERT_STRING_EQUAL(cmd->input_file, "in.txt");
+    CU_ASSERT_PTR_NULL(*next);
+  }
+  arena_free(&arena);
+}
+
+void test_tokenize_here_operators(void) {
+  Arena arena;
+  arena_init(&arena, 256);
+  const char *line = "cat<<EOF <<<x <in";
+  Token *tokens;
+  int count = tokenize(line, strlen(line), &arena, &tokens);
+  CU_ASSERT_EQUAL(count, 7);
+  if (count == 7) {
+    TokenKind kinds[] = {TOKEN_WORD,  TOKEN_HERE_DOC, TOKEN_WORD,
+                         TOKEN_HERE_STRING, TOKEN_WORD, TOKEN_INPUT,
+                         TOKEN_WORD};
+    for (int i = 0; i < count; i++) {
+      CU_ASSERT_EQUAL(tokens[i].kind, kinds[i]);
+    }
+    CU_ASSERT_EQUAL(tokens[3].length, 3);
+  }
+  arena_free(&arena);
+}
+
+void test_tokenize_parameter_hash(void) {
+  Arena arena;
+  arena_init(&arena, 256);
+  // inside ${...} a # is an operator, anywhere else it starts a comment
+  const char *line = "echo ${#X} ${X#a*}b ${X%%.c}#gone # comment";
+  Token *tokens;
+  int count = tokenize(line, strlen(line), &arena, &tokens);
+  CU_ASSERT_EQUAL(count, 4);
+  if (count == 4) {
+    CU_ASSERT_EQUAL(tokens[1].length, 5);
+    CU_ASSERT_EQUAL(tokens[2].length, 8);
+    CU_ASSERT_EQUAL(tokens[3].length, 8);
+  }
+  arena_free(&arena);
+}
+
 /* Suite Initialization */
 
 int init_suite(void) { return 0; }
@@ -483,6 +773,8 @@ int main() {
   CU_add_test(suite2, "Command with args", test_command_with_args);
   CU_add_test(suite2, "Multiple spaces", test_command_with_multiple_spaces);
   CU_add_test(suite2, "Leading spaces", test_command_with_leading_spaces);
+  CU_add_test(suite2, "Token spans and kinds", test_tokenize_spans);
+  CU_add_test(suite2, "Keywords as arguments", test_keyword_as_argument);
 
   suite3 = CU_add_suite("Conditional Commands", init_suite, clean_suite);
   if (NULL == suite3) {
@@ -547,6 +839,12 @@ int main() {
               test_pipeline_with_output_redirection);
   CU_add_test(suite8, "Pipeline both redirections",
               test_complex_pipeline_with_both_redirections);
+  CU_add_test(suite8, "Background command", test_background);
+  CU_add_test(suite8, "time prefix", test_time_prefix);
+  CU_add_test(suite8, "Here-string", test_here_string);
+  CU_add_test(suite8, "Here-doc body", test_here_doc);
+  CU_add_test(suite8, "Here operators", test_tokenize_here_operators);
+  CU_add_test(suite8, "# inside ${}", test_tokenize_parameter_hash);
   CU_add_test(suite8, "All features combined",
               test_conditional_pipeline_redirections);
 
@@ -557,6 +855,10 @@ int main() {
   }
   CU_add_test(suite9, "Multiple parses", test_multiple_parses);
   CU_add_test(suite9, "Free NULL cmd", test_free_null_cmd);
+  CU_add_test(suite9, "More than ten args", test_many_args);
+  CU_add_test(suite9, "Single block", test_single_block);
+  CU_add_test(suite9, "Parse into arena", test_parse_arena);
+  CU_add_test(suite9, "Parse a slice of a buffer", test_parse_line_length);
 
   CU_basic_set_mode(CU_BRM_VERBOSE);
   CU_basic_run_tests();
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_BUFFER (64 * 1024)
+#define MAX_EVENT 1024
+
+int trace_enabled = 0;
+
+static int trace_fd = -1;
+static pid_t trace_pid;
+static long trace_line;
+
+/*
+Any thread can add an event without a lock. It reserves its bytes with one
+atomic add on reserved, copies them in, then adds them to committed.
+The thread whose reservation runs past the end is the one that writes the
+buffer out: it waits for everyone before it to finish copying, writes,
+and opens the buffer again. Threads that reserved past it wait for that
+and try again. Writing out is the only time anyone waits.
+*/
+static char buffer[TRACE_BUFFER];
+static size_t reserved;
+static size_t committed;
+
+static void write_out(size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(trace_fd, buffer + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+}
+
+// reserves len bytes, or writes the buffer out first when they don't fit.
+// len 0 just writes it out.
+static size_t reserve(size_t len) {
+  for (;;) {
+    size_t ask = len > 0 ? len : TRACE_BUFFER + 1;
+    size_t at = __atomic_fetch_add(&reserved, ask, __ATOMIC_ACQ_REL);
+    if (at + ask <= TRACE_BUFFER) {
+      return at;
+    }
+    if (at <= TRACE_BUFFER) {
+      // ours crossed the end, so everything before at is ours to write
+      while (__atomic_load_n(&committed, __ATOMIC_ACQUIRE) != at) {
+        sched_yield();
+      }
+      write_out(at);
+      __atomic_store_n(&committed, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&reserved, 0, __ATOMIC_RELEASE);
+      if (len == 0) {
+        return 0;
+      }
+      continue;
+    }
+    // someone else is writing out
+    while (__atomic_load_n(&reserved, __ATOMIC_ACQUIRE) > TRACE_BUFFER) {
+      sched_yield();
+    }
+  }
+}
+
+void trace_flush(void) {
+  if (trace_enabled) {
+    reserve(0);
+  }
+}
+
+// a forked child starts with the parent's unwritten events, which are the
+// parent's to write
+static void forget_after_fork(void) {
+  reserved = 0;
+  committed = 0;
+  trace_pid = getpid();
+}
+
+void trace_init(void) {
+  const char *path = getenv("MYSH_TRACE");
+  if (path == NULL || *path == '\0') {
+    return;
+  }
+  // O_APPEND keeps blocks written by forked children whole
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (trace_fd < 0) {
+    perror("MYSH_TRACE");
+    return;
+  }
+  trace_pid = getpid();
+  pthread_atfork(NULL, NULL, forget_after_fork);
+  atexit(trace_flush);
+  trace_enabled = 1;
+}
+
+void trace_set_line(long line) { trace_line = line; }
+
+const char *trace_escape(const char *s, char *out, int size) {
+  int len = 0;
+  for (; *s != '\0' && len < size - 7; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      out[len++] = '\\';
+      out[len++] = c;
+    } else if (c < 0x20) {
+      len += snprintf(out + len, size - len, "\\u%04x", c);
+    } else {
+      out[len++] = c;
+    }
+  }
+  out[len] = '\0';
+  return out;
+}
+
+void trace_event(const char *event, const char *fields, ...) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  char line[MAX_EVENT];
+  int len = snprintf(line, sizeof(line),
+                     "{\"ts\":%lld,\"pid\":%d,\"line\":%ld,\"ev\":\"%s\"",
+                     (long long)now.tv_sec * 1000000000LL + now.tv_nsec,
+                     (int)trace_pid, trace_line, event);
+  if (fields != NULL && len < (int)sizeof(line)) {
+    line[len++] = ',';
+    va_list args;
+    va_start(args, fields);
+    len += vsnprintf(line + len, sizeof(line) - len, fields, args);
+    va_end(args);
+  }
+  // a cut off event still has to end the line
+  if (len > (int)sizeof(line) - 3) {
+    len = sizeof(line) - 3;
+  }
+  line[len++] = '}';
+  line[len++] = '\n';
+
+  size_t at = reserve(len);
+  memcpy(buffer + at, line, len);
+  __atomic_fetch_add(&committed, len, __ATOMIC_RELEASE);
+}
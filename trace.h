@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// With MYSH_TRACE=path set, the shell appends one JSON object per event to
+// path: what happened, when (CLOCK_MONOTONIC ns), in which pid and for
+// which script line. Events are buffered in memory and written in big
+// blocks, so tracing costs a snprintf and a memcpy per event.
+
+extern int trace_enabled;
+
+// opens MYSH_TRACE if it is set
+void trace_init(void);
+
+// the script line the events that follow belong to
+void trace_set_line(long line);
+
+// appends {"ts":...,"pid":...,"line":...,"ev":event<,fields>}. fields is a
+// printf format for the rest of the object, without braces, or NULL.
+// Strings in it must be passed through trace_escape().
+void trace_event(const char *event, const char *fields, ...);
+
+// s as the inside of a JSON string, cut to fit into out
+const char *trace_escape(const char *s, char *out, int size);
+
+// writes out whatever is buffered. Runs at exit too, a child that leaves
+// with _exit() has to call it itself.
+void trace_flush(void);
+
+// costs one branch when tracing is off
+#define TRACE(...)                                                             \
+  do {                                                                         \
+    if (trace_enabled) {                                                       \
+      trace_event(__VA_ARGS__);                                                \
+    }                                                                          \
+  } while (0)
+
+#endif
@@ -0,0 +1,523 @@
+#define _GNU_SOURCE
+#include "vars.h"
+#include "arena.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOTS 64 // must be a power of two
+#define MAX_ENV_NAME 256 // longer names are never looked up in the environment
+
+typedef struct {
+  unsigned refs;
+  size_t len;
+  char text[]; // '\0'-terminated
+} Value;
+
+typedef struct {
+  char *name;
+  size_t len;
+  uint32_t hash;
+  Value *value; // NULL while unset
+} Symbol;
+
+static Symbol **slots = NULL;
+static size_t num_slots = 0;
+static size_t used = 0;
+
+// expanded words of the current line
+static Arena words;
+static int words_ready = 0;
+
+// where a word is put together before it goes into words
+static char *scratch = NULL;
+static size_t scratch_len = 0;
+static size_t scratch_cap = 0;
+
+static char status_text[16]; // $? of the current line
+
+// one $ reference in a word
+typedef struct {
+  size_t end; // just past it
+  const char *name;
+  size_t name_len;
+  char op;     // 0 for $NAME, '-' for :-, '#' or '%' to remove a pattern,
+               // 'L' for ${#NAME}
+  int longest; // ## or %%
+  const char *arg;
+  size_t arg_len;
+} Ref;
+
+// 32 bit FNV-1a
+static uint32_t hash_name(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// returns the slot holding name, or the empty slot where it belongs
+static Symbol **find_slot(Symbol **table, size_t size, const char *name,
+                          size_t len, uint32_t hash) {
+  size_t i = hash & (size - 1);
+  while (table[i] != NULL) {
+    if (table[i]->hash == hash && table[i]->len == len &&
+        memcmp(table[i]->name, name, len) == 0) {
+      return &table[i];
+    }
+    i = (i + 1) & (size - 1);
+  }
+  return &table[i];
+}
+
+static int grow(void) {
+  size_t new_size = num_slots == 0 ? INITIAL_SLOTS : num_slots * 2;
+  Symbol **table = calloc(new_size, sizeof(Symbol *));
+  if (table == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < num_slots; i++) {
+    if (slots[i] != NULL) {
+      *find_slot(table, new_size, slots[i]->name, slots[i]->len, slots[i]->hash) = slots[i];
+    }
+  }
+  free(slots);
+  slots = table;
+  num_slots = new_size;
+  return 0;
+}
+
+// the symbol for name, made if create is set and there is none yet
+static Symbol *intern(const char *name, size_t len, int create) {
+  uint32_t hash = hash_name(name, len);
+  if (num_slots > 0) {
+    Symbol *found = *find_slot(slots, num_slots, name, len, hash);
+    if (found != NULL || !create) {
+      return found;
+    }
+  } else if (!create) {
+    return NULL;
+  }
+  // keep the table at most half full
+  if ((used + 1) * 2 > num_slots && grow() != 0) {
+    return NULL;
+  }
+  Symbol *symbol = malloc(sizeof(Symbol) + len + 1);
+  if (symbol == NULL) {
+    return NULL;
+  }
+  symbol->name = (char *)(symbol + 1);
+  memcpy(symbol->name, name, len);
+  symbol->name[len] = '\0';
+  symbol->len = len;
+  symbol->hash = hash;
+  symbol->value = NULL;
+  *find_slot(slots, num_slots, name, len, hash) = symbol;
+  used++;
+  return symbol;
+}
+
+static Value *value_new(const char *text, size_t len) {
+  Value *value = malloc(sizeof(Value) + len + 1);
+  if (value != NULL) {
+    value->refs = 0;
+    value->len = len;
+    memcpy(value->text, text, len);
+    value->text[len] = '\0';
+  }
+  return value;
+}
+
+static void set_value(Symbol *symbol, Value *value) {
+  value->refs++;
+  Value *old = symbol->value;
+  symbol->value = value;
+  if (old != NULL && --old->refs == 0) {
+    free(old);
+  }
+}
+
+// the text of name, from the shell's variables or else the environment.
+// *value is set when it is a shell variable. NULL if unset.
+static const char *lookup(const char *name, size_t len, size_t *value_len,
+                          Value **value) {
+  if (value != NULL) {
+    *value = NULL;
+  }
+  if (len == 1 && name[0] == '?') {
+    *value_len = strlen(status_text);
+    return status_text;
+  }
+  Symbol *symbol = intern(name, len, 0);
+  if (symbol != NULL && symbol->value != NULL) {
+    if (value != NULL) {
+      *value = symbol->value;
+    }
+    *value_len = symbol->value->len;
+    return symbol->value->text;
+  }
+  char env_name[MAX_ENV_NAME];
+  if (len >= sizeof(env_name)) {
+    return NULL;
+  }
+  memcpy(env_name, name, len);
+  env_name[len] = '\0';
+  const char *text = getenv(env_name);
+  if (text != NULL) {
+    *value_len = strlen(text);
+  }
+  return text;
+}
+
+static int is_name_start(char c) { return isalpha((unsigned char)c) || c == '_'; }
+
+static int is_name_char(char c) { return isalnum((unsigned char)c) || c == '_'; }
+
+// how long the name at the start of s is, 0 if there isn't one
+static size_t name_length(const char *s, size_t len) {
+  if (len == 0 || (s[0] != '?' && !is_name_start(s[0]))) {
+    return 0;
+  }
+  if (s[0] == '?') {
+    return 1;
+  }
+  size_t n = 1;
+  while (n < len && is_name_char(s[n])) {
+    n++;
+  }
+  return n;
+}
+
+// reads the reference at word[i], a '$'. Returns 1, 0 if the $ is just a
+// character, or -1 for a ${ that is broken.
+static int parse_ref(const char *word, size_t len, size_t i, Ref *ref) {
+  memset(ref, 0, sizeof(*ref));
+  const char *s = word + i + 1;
+  size_t left = len - i - 1;
+  if (left > 0 && *s != '{') {
+    ref->name = s;
+    ref->name_len = name_length(s, left);
+    ref->end = i + 1 + ref->name_len;
+    return ref->name_len > 0;
+  }
+  if (left == 0) {
+    return 0;
+  }
+
+  // ${...}, the } that matches, so a default can hold references too
+  size_t depth = 1, close = 1;
+  for (; close < left; close++) {
+    if (s[close] == '{') {
+      depth++;
+    } else if (s[close] == '}' && --depth == 0) {
+      break;
+    }
+  }
+  if (close == left) {
+    return -1;
+  }
+  ref->end = i + 1 + close + 1;
+  const char *inside = s + 1;
+  size_t inside_len = close - 1;
+
+  if (inside_len > 1 && inside[0] == '#') {
+    ref->op = 'L';
+    ref->name = inside + 1;
+    ref->name_len = name_length(inside + 1, inside_len - 1);
+    return ref->name_len == inside_len - 1 ? 1 : -1;
+  }
+  ref->name = inside;
+  ref->name_len = name_length(inside, inside_len);
+  if (ref->name_len == 0) {
+    return -1;
+  }
+  const char *op = inside + ref->name_len;
+  size_t op_len = inside_len - ref->name_len;
+  if (op_len == 0) {
+    return 1;
+  }
+  if (op_len >= 2 && op[0] == ':' && op[1] == '-') {
+    ref->op = '-';
+    ref->arg = op + 2;
+    ref->arg_len = op_len - 2;
+    return 1;
+  }
+  if (op[0] == '#' || op[0] == '%') {
+    ref->op = op[0];
+    ref->longest = op_len >= 2 && op[1] == op[0];
+    ref->arg = op + 1 + ref->longest;
+    ref->arg_len = op_len - 1 - ref->longest;
+    return 1;
+  }
+  return -1;
+}
+
+static int append(const char *s, size_t n) {
+  if (scratch_len + n + 1 > scratch_cap) {
+    size_t cap = scratch_cap > 0 ? scratch_cap : 256;
+    while (scratch_len + n + 1 > cap) {
+      cap *= 2;
+    }
+    char *grown = realloc(scratch, cap);
+    if (grown == NULL) {
+      perror("malloc failed");
+      return -1;
+    }
+    scratch = grown;
+    scratch_cap = cap;
+  }
+  memcpy(scratch + scratch_len, s, n);
+  scratch_len += n;
+  scratch[scratch_len] = '\0';
+  return 0;
+}
+
+static int expand_into(const char *word, size_t len);
+
+// appends text with the shortest (or longest) match of the pattern in
+// ref removed from its start ('#') or end ('%')
+static int remove_pattern(const Ref *ref, const char *text, size_t text_len) {
+  size_t mark = scratch_len;
+  // pattern\0text\0, then the part that is kept goes back to mark
+  if (expand_into(ref->arg, ref->arg_len) != 0 || append("", 1) != 0) {
+    return -1;
+  }
+  size_t text_at = scratch_len;
+  if (append(text, text_len) != 0) {
+    return -1;
+  }
+  const char *pattern = scratch + mark;
+  char *s = scratch + text_at;
+  size_t from = 0, to = text_len;
+  if (ref->op == '#') {
+    for (size_t n = 0; n <= text_len; n++) {
+      size_t cut = ref->longest ? text_len - n : n;
+      char c = s[cut];
+      s[cut] = '\0';
+      int matched = fnmatch(pattern, s, 0) == 0;
+      s[cut] = c;
+      if (matched) {
+        from = cut;
+        break;
+      }
+    }
+  } else {
+    for (size_t n = 0; n <= text_len; n++) {
+      size_t cut = ref->longest ? n : text_len - n;
+      if (fnmatch(pattern, s + cut, 0) == 0) {
+        to = cut;
+        break;
+      }
+    }
+  }
+  memmove(scratch + mark, s + from, to - from);
+  scratch_len = mark + to - from;
+  scratch[scratch_len] = '\0';
+  return 0;
+}
+
+static int expand_ref(const Ref *ref) {
+  size_t text_len = 0;
+  const char *text = lookup(ref->name, ref->name_len, &text_len, NULL);
+  if (text == NULL) {
+    text = "";
+  }
+  switch (ref->op) {
+  case 'L': {
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%zu", text_len);
+    return append(digits, n);
+  }
+  case '-':
+    if (text_len == 0) {
+      return expand_into(ref->arg, ref->arg_len);
+    }
+    return append(text, text_len);
+  case '#':
+  case '%':
+    return remove_pattern(ref, text, text_len);
+  default:
+    return append(text, text_len);
+  }
+}
+
+// appends the expansion of the first len bytes of word to scratch
+static int expand_into(const char *word, size_t len) {
+  size_t start = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (word[i] != '$') {
+      continue;
+    }
+    Ref ref;
+    int found = parse_ref(word, len, i, &ref);
+    if (found < 0) {
+      fprintf(stderr, "%.*s: bad substitution\n", (int)len, word);
+      return -1;
+    }
+    if (found == 0) {
+      continue;
+    }
+    if (append(word + start, i - start) != 0 || expand_ref(&ref) != 0) {
+      return -1;
+    }
+    start = ref.end;
+    i = ref.end - 1;
+  }
+  return append(word + start, len - start);
+}
+
+// expands one word. Without a $ that is word itself, and for a lone $NAME
+// or ${NAME} the variable's own text, which sets *shared when it is a
+// shell variable. Anything else is put together in words. NULL on errors.
+static const char *expand_word(const char *word, size_t *len, Value **shared) {
+  *shared = NULL;
+  const char *dollar = strchr(word, '$');
+  if (dollar == NULL) {
+    *len = strlen(word);
+    return word;
+  }
+  size_t word_len = strlen(word);
+  Ref ref;
+  if (dollar == word && parse_ref(word, word_len, 0, &ref) == 1 &&
+      ref.end == word_len && ref.op == 0) {
+    const char *text = lookup(ref.name, ref.name_len, len, shared);
+    if (text == NULL) {
+      *len = 0;
+      return "";
+    }
+    return text;
+  }
+  scratch_len = 0;
+  if (expand_into(word, word_len) != 0) {
+    return NULL;
+  }
+  char *expanded = arena_strndup(&words, scratch, scratch_len);
+  if (expanded == NULL) {
+    perror("malloc failed");
+    return NULL;
+  }
+  *len = scratch_len;
+  return expanded;
+}
+
+// what came from the last line is no longer used
+static void start_line(int status) {
+  if (!words_ready) {
+    arena_init(&words, 4096);
+    words_ready = 1;
+  }
+  arena_reset(&words);
+  snprintf(status_text, sizeof(status_text), "%d", status);
+}
+
+int vars_is_assignment(const char *word) {
+  if (!is_name_start(word[0])) {
+    return 0;
+  }
+  size_t n = 1;
+  while (is_name_char(word[n])) {
+    n++;
+  }
+  return word[n] == '=';
+}
+
+int vars_assign(char **args, int num_args, int status) {
+  start_line(status);
+  for (int i = 0; i < num_args; i++) {
+    const char *equals = strchr(args[i], '=');
+    size_t len;
+    Value *value;
+    const char *text = expand_word(equals + 1, &len, &value);
+    if (text == NULL) {
+      return -1;
+    }
+    if (value == NULL && (value = value_new(text, len)) == NULL) {
+      perror("malloc failed");
+      return -1;
+    }
+    Symbol *symbol = intern(args[i], equals - args[i], 1);
+    if (symbol == NULL) {
+      if (value->refs == 0) {
+        free(value);
+      }
+      perror("malloc failed");
+      return -1;
+    }
+    set_value(symbol, value);
+  }
+  return 0;
+}
+
+static int expand_in_place(char **word) {
+  if (*word == NULL) {
+    return 0;
+  }
+  size_t len;
+  Value *shared;
+  const char *text = expand_word(*word, &len, &shared);
+  if (text == NULL) {
+    return -1;
+  }
+  // nothing writes into args, they are only passed on
+  *word = (char *)text;
+  return 0;
+}
+
+// a <<< word is kept with its '\n' and isn't '\0'-terminated when it comes
+// from a compiled script
+static int expand_here_string(ParsedCmd *cmd) {
+  if (memchr(cmd->input_text, '$', cmd->input_text_len) == NULL) {
+    return 0;
+  }
+  scratch_len = 0;
+  if (expand_into(cmd->input_text, cmd->input_text_len - 1) != 0 ||
+      append("\n", 1) != 0) {
+    return -1;
+  }
+  char *expanded = arena_strndup(&words, scratch, scratch_len);
+  if (expanded == NULL) {
+    perror("malloc failed");
+    return -1;
+  }
+  cmd->input_text = expanded;
+  cmd->input_text_len = scratch_len;
+  return 0;
+}
+
+int vars_expand(ParsedCmd *cmd, int status) {
+  start_line(status);
+  for (int i = 0; i < cmd->num_commands; i++) {
+    Command *command = &cmd->commands[i];
+    for (int j = 0; j < command->num_args; j++) {
+      if (expand_in_place(&command->args[j]) != 0) {
+        return -1;
+      }
+    }
+  }
+  if (expand_in_place(&cmd->input_file) != 0 ||
+      expand_in_place(&cmd->output_file) != 0 ||
+      (cmd->is_here_string && expand_here_string(cmd) != 0)) {
+    return -1;
+  }
+  return 0;
+}
+
+const char *vars_get(const char *name) {
+  size_t len;
+  return lookup(name, strlen(name), &len, NULL);
+}
+
+int vars_set(const char *name, const char *value) {
+  Symbol *symbol = intern(name, strlen(name), 1);
+  Value *v = symbol != NULL ? value_new(value, strlen(value)) : NULL;
+  if (v == NULL) {
+    return -1;
+  }
+  set_value(symbol, v);
+  return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include "parser.h"
+
+/*
+Shell variables and $ expansion. Names are interned: each one is stored
+once in a hash table the first time it is seen. A value is a refcounted
+string that never changes, so NAME=$OTHER shares OTHER's value and setting
+a variable gives it a new value instead of writing into the old one.
+
+A word expands to one arg, even when it is empty or has spaces in it. A
+word without a $ is left alone, and a word that is just $NAME or ${NAME}
+becomes the variable's own text, so neither allocates. Names that aren't
+shell variables come from the environment.
+*/
+
+// 1 if word is NAME=value
+int vars_is_assignment(const char *word);
+
+// runs a line of NAME=value words, expanding each value. status is what
+// $? gives. 0, or -1 after printing why.
+int vars_assign(char **args, int num_args, int status);
+
+// expands the args, redirect files and <<< word of cmd in place.
+// New words live until the next vars_expand() or vars_assign(). 0, or -1
+// after printing why.
+int vars_expand(ParsedCmd *cmd, int status);
+
+// the shell variable or environment variable called name, NULL if unset
+const char *vars_get(const char *name);
+
+// 0, or -1 if out of memory
+int vars_set(const char *name, const char *value);
+
+#endif